@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "connection.h"
+#include "error.h"
+#include "log.h"
+
+
+void tomo_connection_init(TOMO_CONNECTION *conn, void *data)
+{
+    conn->data = data;
+    conn->rlen = conn->rpos = 0;
+    conn->woff = conn->wlen = 0;
+}
+
+
+/** @brief Move the unparsed tail of the read buffer to its start */
+static void tomo_connection_compact(TOMO_CONNECTION *conn)
+{
+    if (conn->rpos) {
+        conn->rlen -= conn->rpos;
+        memmove(conn->rbuf, conn->rbuf + conn->rpos, conn->rlen);
+        conn->rpos = 0;
+    }
+}
+
+
+int tomo_connection_recv(TOMO_CONNECTION *conn, TOMO_ENDPOINT *endp)
+{
+    wchar_t ip[65];
+    size_t len;
+
+    tomo_connection_compact(conn);
+    len = BUFLEN(conn->rbuf) - conn->rlen;
+    if (!len) {
+        tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
+        tomo_error_raise(TOMO_ERROR_USER, L"Query line too long", L"Protocol error from %s", ip);
+        return TOMO_ENDPT_ERROR;
+    }
+    switch (tomo_endpoint_recv(endp, conn->rbuf + conn->rlen, &len)) {
+    case 0:
+        break;
+    case 1:
+        /* Spurious wakeup, nothing to read after all */
+        return 0;
+    default:
+        return TOMO_ENDPT_ERROR;
+    }
+    if (!len) {
+        return TOMO_ENDPT_CLOSED;
+    }
+    conn->rlen += len;
+    return 0;
+}
+
+
+const char *tomo_connection_next(TOMO_CONNECTION *conn)
+{
+    char *line, *nl;
+
+    line = conn->rbuf + conn->rpos;
+    nl = memchr(line, '\n', conn->rlen - conn->rpos);
+    if (!nl) {
+        return NULL;
+    }
+    conn->rpos = nl - conn->rbuf + 1;
+    if (nl > line && nl[-1] == '\r') {
+        nl--;
+    }
+    *nl = '\0';
+    return line;
+}
+
+
+int tomo_connection_queue(TOMO_CONNECTION *conn, const char *buf, size_t len)
+{
+    size_t newcap = conn->wcap;
+    char *newbuf;
+
+    if (conn->woff && conn->wlen + len > newcap) {
+        /* Reclaim the space taken by replies that were already sent */
+        conn->wlen -= conn->woff;
+        memmove(conn->wbuf, conn->wbuf + conn->woff, conn->wlen);
+        conn->woff = 0;
+    }
+    if (conn->wlen + len > newcap) {
+        do {
+            newcap = newcap * 2 + 256;
+        } while (conn->wlen + len > newcap);
+        newbuf = realloc(conn->wbuf, newcap);
+        if (!newbuf) {
+            tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Cannot grow reply buffer");
+            return 1;
+        }
+        conn->wbuf = newbuf;
+        conn->wcap = newcap;
+    }
+    memcpy(conn->wbuf + conn->wlen, buf, len);
+    conn->wlen += len;
+    return 0;
+}
+
+
+int tomo_connection_reply(TOMO_CONNECTION *conn,
+                          TOMO_ENDPOINT   *endp,
+                          const char      *buf,
+                          size_t           len)
+{
+    const size_t unparsed = conn->rlen - conn->rpos;
+    int sent;
+
+    if (!tomo_connection_pending(conn)
+     && !memchr(conn->rbuf + conn->rpos, '\n', unparsed)) {
+        sent = tomo_endpoint_send(endp, buf, len);
+        if (sent < 0) {
+            return 1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return (len) ? tomo_connection_queue(conn, buf, len) : 0;
+}
+
+
+int tomo_connection_flush(TOMO_CONNECTION *conn, TOMO_ENDPOINT *endp)
+{
+    int sent;
+
+    if (tomo_connection_pending(conn)) {
+        sent = tomo_endpoint_send(endp,
+                                  conn->wbuf + conn->woff,
+                                  tomo_connection_pending(conn));
+        if (sent < 0) {
+            return 1;
+        }
+        conn->woff += sent;
+    }
+    if (!tomo_connection_pending(conn)) {
+        conn->woff = conn->wlen = 0;
+    }
+    return 0;
+}
+
+
+SHORT tomo_connection_events(const TOMO_CONNECTION *conn)
+{
+    const size_t pending = tomo_connection_pending(conn);
+    SHORT res = 0;
+
+    if (pending < TOMO_CONN_HIWAT) {
+        res |= POLLIN;
+    }
+    if (pending) {
+        res |= POLLOUT;
+    }
+    return res;
+}
+
+
+void tomo_connection_clear(TOMO_CONNECTION *conn)
+{
+    free(conn->wbuf);
+    conn->wbuf = NULL;
+    conn->woff = conn->wlen = conn->wcap = 0;
+}
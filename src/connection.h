@@ -0,0 +1,146 @@
+#pragma once
+
+#ifndef TOMOSRV_CONNECTION_H
+#define TOMOSRV_CONNECTION_H
+
+#include "defines.h"
+#include "endpoint.h"
+#include "structures/slab.h"
+#include "structures/wheel.h"
+
+
+/** Size of the per-connection read buffer. No single query line, including its
+ *  newline, may be longer than this
+ */
+#define TOMO_CONN_RBUFLEN 4096
+
+
+/** Once this many reply bytes are waiting on a connection, no more queries are
+ *  read from it until the client catches up
+ */
+#define TOMO_CONN_HIWAT 65536
+
+
+/** Per-connection protocol state. Queries are newline-terminated (a carriage
+ *  return before the newline is dropped), and any number of them may arrive in
+ *  one segment or be split across several
+ */
+typedef struct tomo_connection {
+    void *data;     /* Whoever owns the connection */
+
+    TOMO_HANDLE hndl;   /* Multiplexer handle of the endpoint */
+    TOMO_TIMER timer;   /* Idle/read deadline, owned by data */
+
+    size_t rlen;    /* Bytes buffered in rbuf */
+    size_t rpos;    /* Offset of the first line not yet handed out */
+
+    char  *wbuf;    /* Replies waiting to be sent are in [woff, wlen) */
+    size_t woff, wlen, wcap;
+
+    char rbuf[TOMO_CONN_RBUFLEN];
+} TOMO_CONNECTION;
+
+
+/** @brief Reset @p conn for a new client. A reply buffer left over from a
+ *      previous client is kept for reuse, so @p conn must either be zeroed or
+ *      have been used by this interface before
+ *  @param conn
+ *      Connection state
+ *  @param data
+ *      Owner pointer, stored in the data field
+ */
+void tomo_connection_init(TOMO_CONNECTION *conn, void *data);
+
+
+/** @brief Receive whatever the system has buffered for @p endp into the read
+ *      buffer of @p conn. Lines previously returned by tomo_connection_next are
+ *      invalidated by this call
+ *  @param conn
+ *      Connection state
+ *  @param endp
+ *      Connected endpoint
+ *  @returns Zero on success (including when no data was available), or
+ *      TOMO_ENDPT_CLOSED if the peer shut down, or TOMO_ENDPT_ERROR on error
+ *      (including a query that overflows the buffer)
+ */
+int tomo_connection_recv(TOMO_CONNECTION *conn, TOMO_ENDPOINT *endp);
+
+
+/** @brief Get the next complete query line buffered by @p conn
+ *  @param conn
+ *      Connection state
+ *  @returns A nul-terminated pointer into the read buffer with the line ending
+ *      removed, or NULL if no complete line remains. The pointer is valid until
+ *      the next call to tomo_connection_recv
+ */
+const char *tomo_connection_next(TOMO_CONNECTION *conn);
+
+
+/** @brief Append @p len bytes at @p buf to the reply buffer of @p conn
+ *  @param conn
+ *      Connection state
+ *  @param buf
+ *      Bytes to queue
+ *  @param len
+ *      Number of bytes
+ *  @returns Nonzero on error
+ */
+int tomo_connection_queue(TOMO_CONNECTION *conn, const char *buf, size_t len);
+
+
+/** @brief Reply on @p conn with the @p len bytes at @p buf. If nothing is queued
+ *      ahead of it and no further query is buffered (so there is nothing to
+ *      coalesce it with), it is sent straight from @p buf without a copy.
+ *      Otherwise, or for whatever the socket does not take, it is queued
+ *  @param conn
+ *      Connection state
+ *  @param endp
+ *      Connected endpoint
+ *  @param buf
+ *      Reply bytes
+ *  @param len
+ *      Number of bytes
+ *  @returns Nonzero on error
+ */
+int tomo_connection_reply(TOMO_CONNECTION *conn,
+                          TOMO_ENDPOINT   *endp,
+                          const char      *buf,
+                          size_t           len);
+
+
+/** @brief Send as much of the reply queue as @p endp will take in one call.
+ *      Whatever the (non-blocking) socket does not accept stays queued
+ *  @param conn
+ *      Connection state
+ *  @param endp
+ *      Connected endpoint
+ *  @returns Nonzero on error
+ */
+int tomo_connection_flush(TOMO_CONNECTION *conn, TOMO_ENDPOINT *endp);
+
+
+/** @brief Get the number of queued reply bytes not yet sent */
+static inline size_t tomo_connection_pending(const TOMO_CONNECTION *conn)
+{
+    return conn->wlen - conn->woff;
+}
+
+
+/** @brief Get the poll events @p conn should wait for: POLLOUT while replies
+ *      are queued, and POLLIN unless the queue is past the high-water mark
+ *  @param conn
+ *      Connection state
+ *  @returns Poll event mask
+ */
+SHORT tomo_connection_events(const TOMO_CONNECTION *conn);
+
+
+/** @brief Release the memory held by @p conn. The memory for @p conn itself is
+ *      externally managed
+ *  @param conn
+ *      Connection state
+ */
+void tomo_connection_clear(TOMO_CONNECTION *conn);
+
+
+#endif /* TOMOSRV_CONNECTION_H */
@@ -1,345 +1,1163 @@
-#include <stdio.h>
-
-#include "csv.h"
-#include "log.h"
-#include "error.h"
-
-#include <windows.h>
-#include <csv.h>
-
-#ifndef STDC_FILE_IO
-#   define STDC_FILE_IO 0
-#endif
-
-
-/** @brief Get the size of @p hfile in bytes
- *  @param hfile
- *      Opened file HANDLE
- *  @param len
- *      Length of the file is written here
- *  @returns Nonzero on error
- */
-#if STDC_FILE_IO
-static int tomo_csv_file_size(FILE *fp, size_t *len)
-{
-    static const wchar_t *failmsg = L"Cannot get file size";
-    long tell;
-
-    if (fseek(fp, 0, SEEK_END)) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-        return 1;
-    }
-    tell = ftell(fp);
-    if (tell < 0) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-        return 1;
-    }
-    if (fseek(fp, 0, SEEK_SET)) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-        return 1;
-    }
-    *len = tell;
-    return 0;
-}
-#else
-static int tomo_csv_file_size(HANDLE hfile, size_t *len)
-{
-    static const wchar_t *failmsg = L"Cannot get file size";
-    LARGE_INTEGER size;
-
-    if (!GetFileSizeEx(hfile, &size)) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-        return 1;
-    }
-    *len = size.QuadPart;
-    return 0;
-}
-#endif
-
-
-/** @brief Opens a read-only HANDLE to the file at @p path
- *  @param path
- *      Path to file
- *  @returns The opened HANDLE or INVALID_HANDLE_VALUE on failure
- */
-#if STDC_FILE_IO
-static FILE *tomo_csv_open(const wchar_t *path, size_t *len)
-{
-    static const wchar_t *failfmt = L"Failed to open %s";
-    FILE *res;
-
-    res = _wfopen(path, L"rb");
-    if (!res) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failfmt, path);
-    } else if (tomo_csv_file_size(res, len)) {
-        fclose(res);
-        res = NULL;
-    }
-    return res;
-}
-#else
-static HANDLE tomo_csv_open(const wchar_t *path, size_t *len)
-{
-    static const wchar_t *failfmt = L"Failed to open %s";
-    HANDLE res;
-
-    res = CreateFile(path,
-                     GENERIC_READ,
-                     FILE_SHARE_READ | FILE_SHARE_WRITE,
-                     NULL,
-                     OPEN_EXISTING,
-                     FILE_ATTRIBUTE_NORMAL,
-                     NULL);
-    if (res == INVALID_HANDLE_VALUE) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failfmt, path);
-    } else if (tomo_csv_file_size(res, len)) {
-        CloseHandle(res);
-        res = INVALID_HANDLE_VALUE;
-    }
-    return res;
-}
-#endif
-
-
-/** @brief Allocates memory for the file
- *  @param len
- *      Size of the required mapping
- *  @returns A pointer to the allocated block, or NULL on failure
- */
-static void *tomo_csv_alloc(size_t len)
-{
-    static const wchar_t *failmsg = L"Failed allocating memory for CSV buffer";
-    const DWORD prot = PAGE_READWRITE;
-    DWORD alloctype = MEM_RESERVE | MEM_COMMIT;
-    void *res;
-
-    res = VirtualAlloc(NULL, len, alloctype, prot);
-    if (!res) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-    }
-    return res;
-}
-
-
-/** @brief Buffer the file
- *  @param hfile
- *      File HANDLE
- *  @param dst
- *      Destination buffer
- *  @param len
- *      Size of the file
- *  @returns Nonzero on error
- */
-#if STDC_FILE_IO
-static int tomo_csv_buffer(FILE *fp, void *dst, size_t len)
-{
-    static const wchar_t *failmsg = L"Failed reading CSV file";
-    size_t count;
-
-    count = fread(dst, 1UL, len, fp);
-    if (count < len) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-        return 1;
-    }
-    return 0;
-}
-#else
-static int tomo_csv_buffer(HANDLE hfile, void *dst, size_t len)
-{
-    static const wchar_t *failmsg = L"Failed reading CSV file";
-    DWORD count, nread;
-
-    do {
-        count = (DWORD)len;
-        if (!ReadFile(hfile, dst, count, &nread, NULL)) {
-            tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-            return 1;
-        } else if (nread != count) {
-            tomo_error_raise(TOMO_ERROR_USER, L"File size changed while reading", failmsg);
-            return 1;
-        }
-        len -= count;
-        dst = (char *)dst + count;
-    } while (len);
-    return 0;
-}
-#endif
-
-
-/** @brief Buffer the file at @p path onto the heap
- *  @param path
- *      Path to file
- *  @param len
- *      The length of the file will be written here
- */
-static void *tomo_csv_read(const wchar_t *path, size_t *len)
-#if STDC_FILE_IO
-{
-    FILE *fp;
-    void *res;
-
-    fp = tomo_csv_open(path, len);
-    if (!fp) {
-        return NULL;
-    }
-    res = tomo_csv_alloc(*len);
-    if (res) {
-        if (tomo_csv_buffer(fp, res, *len)) {
-            VirtualFree(res, 0, MEM_RELEASE);
-            res = NULL;
-        }
-    }
-    fclose(fp);
-    return res;
-}
-#else
-{
-    HANDLE hfile;
-    void *res;
-
-    hfile = tomo_csv_open(path, len);
-    if (hfile == INVALID_HANDLE_VALUE) {
-        return NULL;
-    }
-    res = tomo_csv_alloc(*len);
-    if (res) {
-        if (tomo_csv_buffer(hfile, res, *len)) {
-            VirtualFree(res, 0, MEM_RELEASE);
-            res = NULL;
-        }
-    }
-    CloseHandle(hfile);
-    return res;
-}
-#endif
-
-
-struct parse_ctx {
-    TOMO_MRNTABLE *tbl;
-    char name[325]; /* where doin it man */
-    unsigned col;
-    unsigned name_miss;
-    unsigned mrn_miss;
-};
-
-#define COL_NAME 23
-#define COL_MRN  24
-
-
-/** @brief Move the tail of @p s up one, overwriting the first character */
-static void strpop(char *s)
-{
-    do {
-        s[0] = s[1];
-        s++;
-    } while (*s);
-}
-
-
-static void tomo_server_replace_commas(char *name)
-{
-    char *comma;
-
-    comma = strstr(name, ", ");
-    while (comma) {
-        *comma = '^';
-        strpop(comma + 1);
-        comma = strstr(comma, ", ");
-    }
-}
-
-
-static void tomo_csv_fieldcb(void *field, size_t len, void *data)
-{
-    struct parse_ctx *ctx = data;
-    const char *key = field;
-
-    (void)len;
-
-    switch (ctx->col) {
-    case COL_NAME:
-        snprintf(ctx->name, BUFLEN(ctx->name), "%s", key);
-        tomo_server_replace_commas(ctx->name);
-        break;
-    case COL_MRN:
-        if (!ctx->name[0]) {
-            ctx->name_miss++;
-        } else if (!key[0]) {
-            ctx->mrn_miss++;
-        } else {
-            if (!tomo_mrntable_insert(ctx->tbl, ctx->name, key)) {
-                tomo_logf(TOMO_LOG_DEBUG, L"Inserted %S\\%S", ctx->name, key);
-            }
-        }
-        break;
-    }
-    ctx->col++;
-}
-
-
-static void tomo_csv_rowcb(int row, void *data)
-{
-    struct parse_ctx *ctx = data;
-
-    (void)row;
-
-    ctx->col = 0;
-    memset(ctx->name, 0, sizeof ctx->name);
-}
-
-
-/** @brief Parse the CSV file buffered in @p data
- *  @param tbl
- *      MRN table
- *  @param data
- *      CSV data
- *  @param len
- *      Length of @p data
- *  @returns Nonzero on error
- */
-static int tomo_csv_parse(TOMO_MRNTABLE *tbl, void *data, size_t len)
-{
-    struct csv_parser csvp = { 0 };
-    struct parse_ctx ctx = {
-        .tbl = tbl,
-        .col = 0
-    };
-    size_t read;
-    int res;
-
-    res = csv_init(&csvp, CSV_APPEND_NULL);
-    if (res) {
-        res = csv_error(&csvp);
-        tomo_error_raise(TOMO_ERROR_CSV, &res, L"Cannot initialize CSV parser");
-        return 1;
-    }
-    read = csv_parse(&csvp, data, len, tomo_csv_fieldcb, tomo_csv_rowcb, &ctx);
-    res = read < len
-       || csv_fini(&csvp, tomo_csv_fieldcb, tomo_csv_rowcb, &ctx);
-    csv_free(&csvp);
-    if (res) {
-        res = csv_error(&csvp);
-        tomo_error_raise(TOMO_ERROR_CSV, &res, L"Failed parsing CSV");
-    } else if (ctx.mrn_miss) {
-        tomo_logf(TOMO_LOG_WARN, L"CSV: %u patients missing IDs", ctx.mrn_miss);
-    }
-    return tomo_error_state();
-}
-
-
-int tomo_csv_load(TOMO_MRNTABLE *tbl, const wchar_t *path)
-{
-    size_t len;
-    void *data;
-    int res = 1;
-
-    if (tomo_mrntable_init(tbl, 256)) {
-        return 1;
-    }
-    data = tomo_csv_read(path, &len);
-    if (data) {
-        res = tomo_csv_parse(tbl, data, len);
-        VirtualFree(data, 0, MEM_RELEASE);
-    }
-    return res;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csv.h"
+#include "log.h"
+#include "error.h"
+#include "scan.h"
+
+#include <windows.h>
+#include <psapi.h>
+#include <csv.h>
+
+#ifndef STDC_FILE_IO
+#   define STDC_FILE_IO 0
+#endif
+
+#ifndef TOMO_CSV_LIBCSV
+#   define TOMO_CSV_LIBCSV 0
+#endif
+
+
+/** Size of the buffer input that cannot be mapped is streamed through. It only
+ *  grows if a single row does not fit
+ */
+#define TOMO_CSV_BLOCK (1UL << 20)
+
+
+/** @brief Check whether @p path names standard input */
+static bool tomo_csv_is_stdin(const wchar_t *path)
+{
+    return !wcscmp(path, L"-");
+}
+
+
+#if !STDC_FILE_IO
+/** @brief Get the size of @p hfile in bytes
+ *  @param hfile
+ *      Opened file HANDLE
+ *  @param len
+ *      Length of the file is written here
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_file_size(HANDLE hfile, size_t *len)
+{
+    static const wchar_t *failmsg = L"Cannot get file size";
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(hfile, &size)) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+        return 1;
+    }
+    *len = size.QuadPart;
+    return 0;
+}
+#else
+/** @brief Get the size of @p fp in bytes, if it is a file that has one, and
+ *      leave it at the start
+ *  @param fp
+ *      Opened stream
+ *  @returns The size, or zero if it is not known
+ */
+static size_t tomo_csv_size_hint(FILE *fp)
+{
+    long size;
+
+    if (fp == stdin || fseek(fp, 0L, SEEK_END)) {
+        return 0;
+    }
+    size = ftell(fp);
+    rewind(fp);
+    return (size > 0) ? (size_t)size : 0;
+}
+#endif
+
+
+/** @brief Opens the file at @p path for reading, or standard input if @p path
+ *      is "-"
+ *  @param path
+ *      Path to file
+ *  @returns The opened stream or HANDLE, or NULL or INVALID_HANDLE_VALUE
+ *      respectively on failure
+ */
+#if STDC_FILE_IO
+static FILE *tomo_csv_open(const wchar_t *path)
+{
+    static const wchar_t *failfmt = L"Failed to open %s";
+    FILE *res;
+
+    if (tomo_csv_is_stdin(path)) {
+        return stdin;
+    }
+    res = _wfopen(path, L"rb");
+    if (!res) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failfmt, path);
+    }
+    return res;
+}
+#else
+static HANDLE tomo_csv_open(const wchar_t *path)
+{
+    static const wchar_t *failfmt = L"Failed to open %s";
+    HANDLE res;
+
+    if (tomo_csv_is_stdin(path)) {
+        res = GetStdHandle(STD_INPUT_HANDLE);
+        if (!res || res == INVALID_HANDLE_VALUE) {
+            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"No standard input to read");
+            res = INVALID_HANDLE_VALUE;
+        }
+        return res;
+    }
+    /* The cache manager reads ahead more aggressively on sequential handles,
+    which is what backs the page faults taken by the parse */
+    res = CreateFile(path,
+                     GENERIC_READ,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE,
+                     NULL,
+                     OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                     NULL);
+    if (res == INVALID_HANDLE_VALUE) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failfmt, path);
+    }
+    return res;
+}
+#endif
+
+
+/** @brief Read whatever is available from the file, up to @p len bytes
+ *  @param hfile
+ *      File HANDLE or stream
+ *  @param dst
+ *      Destination buffer
+ *  @param len
+ *      Size of @p dst
+ *  @param nread
+ *      The number of bytes read is written here. Zero means end of file
+ *  @returns Nonzero on error
+ */
+#if STDC_FILE_IO
+static int tomo_csv_fill(FILE *fp, void *dst, size_t len, size_t *nread)
+{
+    *nread = fread(dst, 1UL, len, fp);
+    if (!*nread && ferror(fp)) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed reading CSV file");
+        return 1;
+    }
+    return 0;
+}
+#else
+static int tomo_csv_fill(HANDLE hfile, void *dst, size_t len, size_t *nread)
+{
+    DWORD count;
+
+    if (!ReadFile(hfile, dst, (DWORD)len, &count, NULL)) {
+        /* How a pipe says its writer is done */
+        if (GetLastError() != ERROR_BROKEN_PIPE) {
+            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Failed reading CSV file");
+            return 1;
+        }
+        count = 0;
+    }
+    *nread = count;
+    return 0;
+}
+
+
+/** @brief Map a read-only view of the whole file
+ *  @param hfile
+ *      File HANDLE
+ *  @param len
+ *      Size of the file
+ *  @returns A pointer to the view, or NULL on failure
+ */
+static void *tomo_csv_map(HANDLE hfile, size_t len)
+{
+    static const wchar_t *failmsg = L"Failed mapping CSV file";
+    WIN32_MEMORY_RANGE_ENTRY range;
+    HANDLE hmap;
+    void *res;
+
+    if (!len) {
+        /* CreateFileMapping refuses empty files with a vague message */
+        tomo_error_raise(TOMO_ERROR_USER, L"File is empty", failmsg);
+        return NULL;
+    }
+    hmap = CreateFileMappingW(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hmap) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+        return NULL;
+    }
+    res = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, len);
+    if (!res) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+    } else {
+        /* Only a hint, so failure (e.g. before Windows 8) is ignored */
+        range.VirtualAddress = res;
+        range.NumberOfBytes = len;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+    /* The view holds its own reference to the section */
+    CloseHandle(hmap);
+    return res;
+}
+#endif
+
+
+/* Columns used when the header does not name those of interest, which is
+where the MOSAIQ schedule export has always had them */
+#define COL_NAME 23
+#define COL_MRN  24
+
+
+/** Where the fields of interest are */
+struct tomo_csv_layout {
+    char name_hdr[64];  /* Headers to look for, as UTF-8 */
+    char mrn_hdr[64];
+    unsigned name;      /* Columns found under them, or COL_NAME and COL_MRN */
+    unsigned mrn;
+};
+
+
+struct parse_ctx {
+    TOMO_MRNTABLE *tbl;
+    const struct tomo_csv_layout *layout;
+    char name[325]; /* where doin it man */
+    char mrn[TOMO_SCAN_FIELDLEN];
+    bool has_mrn;
+    unsigned col;
+    unsigned name_miss;
+    unsigned mrn_miss;
+};
+
+
+/** @brief Move the tail of @p s up one, overwriting the first character */
+static void strpop(char *s)
+{
+    do {
+        s[0] = s[1];
+        s++;
+    } while (*s);
+}
+
+
+static void tomo_server_replace_commas(char *name)
+{
+    char *comma;
+
+    comma = strstr(name, ", ");
+    while (comma) {
+        *comma = '^';
+        strpop(comma + 1);
+        comma = strstr(comma, ", ");
+    }
+}
+
+
+/** @brief Check for the whitespace trimmed around fields */
+static bool tomo_csv_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+
+/** @brief Set up @p layout to look for the columns headed @p name_hdr and
+ *      @p mrn_hdr
+ *  @param layout
+ *      Layout
+ *  @param name_hdr
+ *      Header of the name column
+ *  @param mrn_hdr
+ *      Header of the MRN column
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_layout_init(struct tomo_csv_layout *layout,
+                                const wchar_t          *name_hdr,
+                                const wchar_t          *mrn_hdr)
+{
+    static const wchar_t *failmsg = L"Bad CSV column header";
+
+    layout->name = COL_NAME;
+    layout->mrn = COL_MRN;
+    if (!WideCharToMultiByte(CP_UTF8, 0, name_hdr, -1, layout->name_hdr,
+                             sizeof layout->name_hdr, NULL, NULL)
+     || !WideCharToMultiByte(CP_UTF8, 0, mrn_hdr, -1, layout->mrn_hdr,
+                             sizeof layout->mrn_hdr, NULL, NULL)) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Find the columns @p layout looks for in the header row at the start
+ *      of @p data. Headers are matched ignoring case and the space around them
+ *  @param layout
+ *      Layout. The columns found are written here
+ *  @param data
+ *      CSV data, from the start of the file
+ *  @param len
+ *      Length of @p data
+ *  @returns The length of the header row, which the parse should skip. If the
+ *      header does not have both columns, COL_NAME and COL_MRN are kept and
+ *      zero is returned, so that the first row is parsed like any other, as
+ *      it always was
+ */
+static size_t tomo_csv_resolve(struct tomo_csv_layout *layout,
+                               const char             *data,
+                               size_t                  len)
+{
+    static const char bom[] = "\xEF\xBB\xBF";
+    unsigned col = 0, name = UINT_MAX, mrn = UINT_MAX;
+    char field[BUFLEN(layout->name_hdr)];
+    const char *hdr;
+    bool quoted = false;
+    size_t i = 0, n = 0;
+    char c;
+
+    if (len >= 3 && !memcmp(data, bom, 3)) {
+        i = 3;
+    }
+    for (; i < len; i++) {
+        c = data[i];
+        if (c == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted || (c != ',' && c != '\n' && c != '\r')) {
+            if (n + 1 < sizeof field) {
+                field[n++] = c;
+            }
+            continue;
+        }
+        while (n && tomo_csv_space(field[n - 1])) {
+            n--;
+        }
+        field[n] = '\0';
+        for (hdr = field; tomo_csv_space(*hdr); hdr++);
+        if (!_stricmp(hdr, layout->name_hdr)) {
+            name = col;
+        }
+        if (!_stricmp(hdr, layout->mrn_hdr)) {
+            mrn = col;
+        }
+        if (c != ',') {
+            break;
+        }
+        col++;
+        n = 0;
+    }
+    if (i == len || name == UINT_MAX || mrn == UINT_MAX) {
+        tomo_logf(TOMO_LOG_WARN, L"CSV: header has no %S and %S columns, using columns %u and %u",
+                  layout->name_hdr, layout->mrn_hdr, COL_NAME, COL_MRN);
+        return 0;
+    }
+    layout->name = name;
+    layout->mrn = mrn;
+    tomo_logf(TOMO_LOG_INFO, L"CSV: names in column %u, MRNs in column %u", name, mrn);
+    return i + 1;
+}
+
+
+/** Bytes sampled from the start of the file by tomo_csv_estimate */
+#define TOMO_CSV_SAMPLE (64UL << 10)
+
+/** Cap on the row estimate, as one made from a freak sample could otherwise
+ *  ask for an absurd table. At about 50 bytes a slot, a table sized for this
+ *  many rows takes 8M slots, or some 400 MiB. Larger files are still loaded,
+ *  the table growing as their rows arrive past that
+ */
+#define TOMO_CSV_MAXESTIMATE (1U << 22)
+
+
+/** @brief Estimate the rows in @p total bytes of CSV from the newlines in a
+ *      sample of it. A name takes at least one row, so this is also about as
+ *      many names as there can be
+ *  @param sample
+ *      The first rows
+ *  @param len
+ *      Length of @p sample, of which up to TOMO_CSV_SAMPLE bytes are looked at
+ *  @param total
+ *      Length of the whole CSV
+ *  @returns The estimate, or zero if the sample has no newline
+ */
+static unsigned tomo_csv_estimate(const char *sample, size_t len, size_t total)
+{
+    unsigned long long rows;
+    size_t i, lines = 0;
+
+    len = (len < TOMO_CSV_SAMPLE) ? len : TOMO_CSV_SAMPLE;
+    for (i = 0; i < len; i++) {
+        lines += sample[i] == '\n';
+    }
+    if (!lines) {
+        return 0;
+    }
+    /* An eighth over, for rows running shorter than those sampled */
+    rows = (unsigned long long)total * lines / len;
+    rows += rows / 8;
+    return (rows < TOMO_CSV_MAXESTIMATE) ? (unsigned)rows : TOMO_CSV_MAXESTIMATE;
+}
+
+
+/** @brief Size @p tbl for the @p rows estimated to be coming. The estimate is
+ *      only a hint, so if the table cannot be grown that far, it is left to
+ *      grow as the rows arrive
+ *  @param tbl
+ *      MRN table
+ *  @param rows
+ *      Estimated rows, see tomo_csv_estimate()
+ */
+static void tomo_csv_presize(TOMO_MRNTABLE *tbl, unsigned rows)
+{
+    if (tomo_mrntable_reserve(tbl, rows)) {
+        tomo_log_error(TOMO_LOG_WARN);
+        tomo_error_reset();
+    }
+}
+
+
+/** @brief Take in a field from one of the columns of interest
+ *  @param ctx
+ *      Parser state
+ *  @param col
+ *      Column of the field
+ *  @param key
+ *      The field
+ */
+static void tomo_csv_field(struct parse_ctx *ctx, unsigned col, const char *key)
+{
+    if (col == ctx->layout->name) {
+        snprintf(ctx->name, BUFLEN(ctx->name), "%s", key);
+        tomo_server_replace_commas(ctx->name);
+    }
+    if (col == ctx->layout->mrn) {
+        snprintf(ctx->mrn, BUFLEN(ctx->mrn), "%s", key);
+        ctx->has_mrn = true;
+    }
+}
+
+
+/** @brief Insert the row just finished, which may have had its columns in
+ *      either order, and reset for the next
+ *  @param ctx
+ *      Parser state
+ */
+static void tomo_csv_row(struct parse_ctx *ctx)
+{
+    if (!ctx->has_mrn) {
+        /* Short row */
+    } else if (!ctx->name[0]) {
+        ctx->name_miss++;
+    } else if (!ctx->mrn[0]) {
+        ctx->mrn_miss++;
+    } else {
+        if (!tomo_mrntable_insert(ctx->tbl, ctx->name, ctx->mrn)) {
+            tomo_logf(TOMO_LOG_DEBUG, L"Inserted %S\\%S", ctx->name, ctx->mrn);
+        }
+    }
+    ctx->name[0] = '\0';
+    ctx->has_mrn = false;
+}
+
+
+#if TOMO_CSV_LIBCSV
+static void tomo_csv_fieldcb(void *field, size_t len, void *data)
+{
+    struct parse_ctx *ctx = data;
+
+    (void)len;
+
+    tomo_csv_field(ctx, ctx->col++, field);
+}
+
+
+static void tomo_csv_rowcb(int row, void *data)
+{
+    struct parse_ctx *ctx = data;
+
+    (void)row;
+
+    ctx->col = 0;
+    tomo_csv_row(ctx);
+}
+#else
+static void tomo_csv_scanfield(unsigned col, const char *field, size_t len, void *data)
+{
+    (void)len;
+
+    tomo_csv_field(data, col, field);
+}
+
+
+static void tomo_csv_scanrow(void *data)
+{
+    tomo_csv_row(data);
+}
+#endif
+
+
+/** Incremental parser state: the tokenizer, and what it feeds */
+struct tomo_csv_parser {
+    struct parse_ctx ctx;
+#if TOMO_CSV_LIBCSV
+    struct csv_parser csvp;
+#else
+    TOMO_SCANNER scan;
+#endif
+};
+
+
+/** @brief Set up @p parser to load into @p tbl. The default build tokenizes
+ *      with tomo_scan, which only materializes the two columns used. Build
+ *      with TOMO_CSV_LIBCSV to tokenize every field with libcsv instead
+ *  @param parser
+ *      Parser state
+ *  @param tbl
+ *      MRN table
+ *  @param layout
+ *      Columns to read
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_begin(struct tomo_csv_parser       *parser,
+                          TOMO_MRNTABLE                *tbl,
+                          const struct tomo_csv_layout *layout)
+#if TOMO_CSV_LIBCSV
+{
+    int res;
+
+    memset(parser, 0, sizeof *parser);
+    parser->ctx.tbl = tbl;
+    parser->ctx.layout = layout;
+    res = csv_init(&parser->csvp, CSV_APPEND_NULL);
+    if (res) {
+        res = csv_error(&parser->csvp);
+        tomo_error_raise(TOMO_ERROR_CSV, &res, L"Cannot initialize CSV parser");
+    }
+    return res;
+}
+#else
+{
+    /* The scanner wants its columns in ascending order */
+    const unsigned lo = (layout->name < layout->mrn) ? layout->name : layout->mrn;
+    const unsigned hi = (layout->name < layout->mrn) ? layout->mrn : layout->name;
+    const TOMO_SCANNER scan = {
+        .cols = { lo, hi },
+        .ncols = (lo == hi) ? 1 : 2,
+        .fieldcb = tomo_csv_scanfield,
+        .rowcb = tomo_csv_scanrow,
+        .data = &parser->ctx
+    };
+
+    memset(&parser->ctx, 0, sizeof parser->ctx);
+    parser->ctx.tbl = tbl;
+    parser->ctx.layout = layout;
+    parser->scan = scan;
+    return 0;
+}
+#endif
+
+
+/** @brief Parse the rows at the front of @p data
+ *  @param parser
+ *      Parser state
+ *  @param data
+ *      CSV data, continuing from whatever was consumed last
+ *  @param len
+ *      Length of @p data
+ *  @param final
+ *      If true, @p data runs to the end of the file
+ *  @returns The number of bytes consumed. Anything left over is the start of
+ *      a row, and should be passed again at the front of the next call. Check
+ *      tomo_error_state() for errors
+ */
+static size_t tomo_csv_feed(struct tomo_csv_parser *parser,
+                            const void             *data,
+                            size_t                  len,
+                            bool                    final)
+#if TOMO_CSV_LIBCSV
+{
+    size_t read;
+    int res;
+
+    /* libcsv carries partial rows itself */
+    read = csv_parse(&parser->csvp, data, len, tomo_csv_fieldcb, tomo_csv_rowcb, &parser->ctx);
+    res = read < len
+       || (final && csv_fini(&parser->csvp, tomo_csv_fieldcb, tomo_csv_rowcb, &parser->ctx));
+    if (res) {
+        res = csv_error(&parser->csvp);
+        tomo_error_raise(TOMO_ERROR_CSV, &res, L"Failed parsing CSV");
+    }
+    return read;
+}
+#else
+{
+    return tomo_scan(&parser->scan, data, len, final);
+}
+#endif
+
+
+/** @brief Release whatever @p parser holds
+ *  @param parser
+ *      Parser state
+ *  @returns The number of names seen without an MRN
+ */
+static unsigned tomo_csv_end(struct tomo_csv_parser *parser)
+{
+#if TOMO_CSV_LIBCSV
+    csv_free(&parser->csvp);
+#endif
+    return parser->ctx.mrn_miss;
+}
+
+
+/** @brief Check whether the tokenizer met quotes that neither open nor close a
+ *      field, and read them as literal characters. libcsv does that without
+ *      telling, so this is only ever known of the scanner
+ *  @param parser
+ *      Parser state
+ *  @param row
+ *      If so, the number of data rows before the first of them is written here
+ *  @returns true if it did
+ */
+static bool tomo_csv_lenient(const struct tomo_csv_parser *parser, size_t *row)
+#if TOMO_CSV_LIBCSV
+{
+    (void)parser;
+    (void)row;
+
+    return false;
+}
+#else
+{
+    *row = parser->scan.lenient_row;
+    return parser->scan.lenient;
+}
+#endif
+
+
+/** @brief Parse the CSV file buffered in @p data
+ *  @param tbl
+ *      MRN table
+ *  @param data
+ *      CSV data
+ *  @param len
+ *      Length of @p data
+ *  @param layout
+ *      Columns to read
+ *  @param mrn_miss
+ *      The number of names without an MRN is written here
+ *  @param lenient
+ *      Whether stray quotes were read as literal characters is written here,
+ *      see tomo_csv_lenient()
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_parse(TOMO_MRNTABLE                *tbl,
+                          const void                   *data,
+                          size_t                        len,
+                          const struct tomo_csv_layout *layout,
+                          unsigned                     *mrn_miss,
+                          bool                         *lenient)
+{
+    struct tomo_csv_parser parser;
+    size_t row;
+
+    *mrn_miss = 0;
+    *lenient = false;
+    if (tomo_csv_begin(&parser, tbl, layout)) {
+        return 1;
+    }
+    tomo_csv_feed(&parser, data, len, true);
+    *mrn_miss = tomo_csv_end(&parser);
+    *lenient = tomo_csv_lenient(&parser, &row);
+    return tomo_error_state();
+}
+
+
+/** @brief Get a description of the tokenizer in use */
+static const wchar_t *tomo_csv_tokenizer(void)
+{
+#if TOMO_CSV_LIBCSV
+    return L"libcsv";
+#else
+    return tomo_scan_name();
+#endif
+}
+
+
+#if !STDC_FILE_IO
+/** Smallest chunk of the file worth a parser thread of its own */
+#define TOMO_CSV_MINCHUNK (4UL << 20)
+
+/** Most chunks the file is split into, which is also as many threads as
+ *  WaitForMultipleObjects can take
+ */
+#define TOMO_CSV_MAXCHUNKS 64
+
+
+/** A run of whole rows of the file, parsed into a table of its own */
+struct tomo_csv_chunk {
+    const char *data;
+    size_t len;
+    const struct tomo_csv_layout *layout;
+    TOMO_MRNTABLE tbl;
+    unsigned mrn_miss;
+    bool lenient;
+    HANDLE thread;
+    int res;
+};
+
+
+/** @brief Split @p data into up to @p n runs of whole rows of roughly equal
+ *      length. A newline only ends a row outside of quotes, and whether a
+ *      position is inside quotes is the parity of the quotes before it. That
+ *      holds as long as quotes only appear around fields, with those inside
+ *      escaped by doubling (which toggles the parity twice), as RFC 4180 has it.
+ *      Where it does not, the scanner finds out, see tomo_csv_parse_chunks()
+ *  @param data
+ *      CSV data
+ *  @param len
+ *      Length of @p data
+ *  @param n
+ *      Number of chunks wanted, at most TOMO_CSV_MAXCHUNKS
+ *  @param ends
+ *      The end offset of each chunk is written here. The last is @p len
+ *  @returns The number of chunks, which is less than @p n if some of them
+ *      turned out empty
+ */
+static unsigned tomo_csv_split(const char *data,
+                               size_t      len,
+                               unsigned    n,
+                               size_t     *ends)
+{
+    unsigned i, count = 0;
+    size_t pos = 0, target;
+    unsigned char quoted = 0;
+
+    for (i = 1; i < n && pos < len; i++) {
+        /* Counting across to the target vectorizes well, walking up to the
+        newline after it does not but is short */
+        target = len / n * i;
+        for (; pos < target; pos++) {
+            quoted ^= data[pos] == '"';
+        }
+        for (; pos < len && (quoted || data[pos] != '\n'); pos++) {
+            quoted ^= data[pos] == '"';
+        }
+        if (pos + 1 < len) {
+            ends[count++] = ++pos;
+        }
+    }
+    ends[count++] = len;
+    return count;
+}
+
+
+/** @brief Entry point of a parser thread. The chunk's table grows as its rows
+ *      arrive, as only the table it is merged into is sized up front. Errors
+ *      are logged here, as the error state does not leave the thread
+ *  @param arg
+ *      The chunk to parse, see struct tomo_csv_chunk
+ *  @returns Zero. The result is left in the chunk
+ */
+static DWORD WINAPI tomo_csv_worker(void *arg)
+{
+    struct tomo_csv_chunk *chunk = arg;
+
+    chunk->res = tomo_mrntable_init(&chunk->tbl, 256)
+              || tomo_csv_parse(&chunk->tbl,
+                                chunk->data,
+                                chunk->len,
+                                chunk->layout,
+                                &chunk->mrn_miss,
+                                &chunk->lenient);
+    if (chunk->res) {
+        tomo_log_error(TOMO_LOG_ERROR);
+    }
+    return 0;
+}
+
+
+/** @brief Get the number of chunks to split @p len bytes of CSV into: one per
+ *      processor, but none shorter than TOMO_CSV_MINCHUNK. libcsv gets a
+ *      single chunk, as it reads stray quotes without telling, and the split
+ *      cannot be checked
+ */
+static unsigned tomo_csv_nchunks(size_t len)
+#if TOMO_CSV_LIBCSV
+{
+    (void)len;
+
+    return 1;
+}
+#else
+{
+    SYSTEM_INFO info;
+    size_t n;
+
+    GetSystemInfo(&info);
+    n = len / TOMO_CSV_MINCHUNK + 1;
+    n = (n < info.dwNumberOfProcessors) ? n : info.dwNumberOfProcessors;
+    return (n < TOMO_CSV_MAXCHUNKS) ? (unsigned)n : TOMO_CSV_MAXCHUNKS;
+}
+#endif
+
+
+/** @brief Parse @p data on as many threads as it has chunks. The first chunk
+ *      is parsed on the calling thread, straight into @p tbl. Every other
+ *      chunk is parsed into a table of its own by a thread of its own, and the
+ *      tables are merged into @p tbl in file order afterwards, so names and
+ *      MRNs come out as they would from a single parser. If a chunk met stray
+ *      quotes, the file from that chunk on is parsed again by a single parser
+ *  @param tbl
+ *      MRN table
+ *  @param data
+ *      CSV data
+ *  @param len
+ *      Length of @p data
+ *  @param layout
+ *      Columns to read
+ *  @param mrn_miss
+ *      The number of names without an MRN is written here
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_parse_chunks(TOMO_MRNTABLE                *tbl,
+                                 const char                   *data,
+                                 size_t                        len,
+                                 const struct tomo_csv_layout *layout,
+                                 unsigned                     *mrn_miss)
+{
+    static const wchar_t *failmsg = L"Failed parsing CSV";
+    size_t ends[TOMO_CSV_MAXCHUNKS];
+    struct tomo_csv_chunk *chunks;
+    LARGE_INTEGER freq, t0, t1;
+    unsigned i, n, started, redo, miss, resizes = 0;
+    bool lenient, relenient;
+    size_t start;
+    double secs;
+    int res;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    n = tomo_csv_split(data, len, tomo_csv_nchunks(len), ends);
+    chunks = calloc(n, sizeof *chunks);
+    if (!chunks) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        return 1;
+    }
+    for (i = 0, start = 0; i < n; start = ends[i++]) {
+        chunks[i].data = data + start;
+        chunks[i].len = ends[i] - start;
+        chunks[i].layout = layout;
+    }
+    for (started = 1; started < n; started++) {
+        chunks[started].thread = CreateThread(NULL,
+                                              0,
+                                              tomo_csv_worker,
+                                              &chunks[started],
+                                              0,
+                                              NULL);
+        if (!chunks[started].thread) {
+            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot create CSV parser thread");
+            break;
+        }
+    }
+    res = started < n
+       || tomo_csv_parse(tbl,
+                         chunks[0].data,
+                         chunks[0].len,
+                         layout,
+                         &chunks[0].mrn_miss,
+                         &chunks[0].lenient);
+    for (i = 1; i < started; i++) {
+        WaitForSingleObject(chunks[i].thread, INFINITE);
+        CloseHandle(chunks[i].thread);
+    }
+    QueryPerformanceCounter(&t1);
+    *mrn_miss = chunks[0].mrn_miss;
+    lenient = chunks[0].lenient;
+    /* The split only finds the ends of rows up to the first stray quote, and
+    the chunk holding it may have been cut mid-row. That chunk and all after it
+    are parsed again in one go, unless it is the last, which runs to the end of
+    the file anyway */
+    for (redo = 0; redo + 1 < n && !chunks[redo].lenient; redo++);
+    redo = (redo + 1 < n) ? redo : n;
+    for (i = 1; i < started; i++) {
+        lenient |= chunks[i].lenient;
+        if (!res && chunks[i].res) {
+            tomo_error_raise(TOMO_ERROR_USER, L"A parser thread failed", failmsg);
+            res = 1;
+        }
+        if (res || i >= redo) {
+            tomo_mrntable_free(&chunks[i].tbl);
+        } else {
+            resizes += chunks[i].tbl.map.resizes;
+            res = tomo_mrntable_merge(tbl, &chunks[i].tbl);
+            *mrn_miss += chunks[i].mrn_miss;
+        }
+    }
+    if (!res && redo < n) {
+        tomo_logf(TOMO_LOG_WARN, L"CSV: stray quotes in chunk %u of %u, parsing the rest of the file on one thread",
+                  redo + 1, n);
+        start = chunks[redo].data - data;
+        if (!redo) {
+            /* The first chunk went straight into tbl */
+            *mrn_miss = 0;
+            res = tomo_mrntable_init(tbl, tbl->map.len);
+        }
+        if (!res) {
+            res = tomo_csv_parse(tbl, data + start, len - start, layout, &miss, &relenient);
+            *mrn_miss += miss;
+        }
+    }
+    free(chunks);
+    if (!res && lenient) {
+        tomo_logf(TOMO_LOG_WARN, L"CSV: quotes that neither open nor close a field were read as literal characters");
+    }
+    if (!res) {
+        /* Not counting the merge, which is table work rather than parsing */
+        secs = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+        tomo_logf(TOMO_LOG_INFO, L"CSV: parsed in %u chunks at %.2f GB/s (%s tokenizer), %u resizes of chunk tables",
+                  n, (secs > 0) ? len / secs / 1e9 : 0.0, tomo_csv_tokenizer(), resizes);
+    }
+    return res;
+}
+#endif /* !STDC_FILE_IO */
+
+
+/** @brief Parse the file as it is read, a block at a time. Only the block in
+ *      hand and the row it ends in are held, so memory use does not depend on
+ *      the size of the input, which may be a pipe. The header is looked for in
+ *      the first block
+ *  @param tbl
+ *      MRN table
+ *  @param hfile
+ *      File HANDLE or stream
+ *  @param hint
+ *      Size of the file if it is known, otherwise zero. If it is known, @p tbl
+ *      is sized for the rows estimated from the first block
+ *  @param layout
+ *      Columns to read, resolved here
+ *  @param len
+ *      The number of bytes read is written here
+ *  @param mrn_miss
+ *      The number of names without an MRN is written here
+ *  @returns Nonzero on error
+ */
+#if STDC_FILE_IO
+static int tomo_csv_stream(TOMO_MRNTABLE          *tbl,
+                           FILE                   *hfile,
+                           size_t                  hint,
+                           struct tomo_csv_layout *layout,
+                           size_t                 *len,
+                           unsigned               *mrn_miss)
+#else
+static int tomo_csv_stream(TOMO_MRNTABLE          *tbl,
+                           HANDLE                  hfile,
+                           size_t                  hint,
+                           struct tomo_csv_layout *layout,
+                           size_t                 *len,
+                           unsigned               *mrn_miss)
+#endif
+{
+    static const wchar_t *failmsg = L"Failed allocating CSV stream buffer";
+    size_t cap = TOMO_CSV_BLOCK, fill = 0, nread = 0, used;
+    struct tomo_csv_parser parser;
+    LARGE_INTEGER freq, t0, t1;
+    char *buf, *grown;
+    double secs;
+    size_t row;
+    bool eof = false, begun = false;
+    int res = 0;
+
+    *len = 0;
+    *mrn_miss = 0;
+    buf = malloc(cap);
+    if (!buf) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        return 1;
+    }
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    while (!res && !eof) {
+        if (fill == cap) {
+            /* The row carried over fills the whole buffer */
+            grown = realloc(buf, cap * 2);
+            if (!grown) {
+                tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+                res = 1;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        /* Pipes hand over whatever was written, so top the buffer up before
+        parsing, rather than rescanning the carried row after every read */
+        do {
+            res = tomo_csv_fill(hfile, buf + fill, cap - fill, &nread);
+            fill += nread;
+            *len += nread;
+        } while (!res && nread && fill < cap);
+        eof = !nread;
+        if (!res && !begun) {
+            used = tomo_csv_resolve(layout, buf, fill);
+            memmove(buf, buf + used, fill - used);
+            fill -= used;
+            if (hint > used) {
+                tomo_csv_presize(tbl, tomo_csv_estimate(buf, fill, hint - used));
+            }
+            res = tomo_csv_begin(&parser, tbl, layout);
+            begun = !res;
+        }
+        if (!res) {
+            used = tomo_csv_feed(&parser, buf, fill, eof);
+            res = tomo_error_state();
+            memmove(buf, buf + used, fill - used);
+            fill -= used;
+        }
+    }
+    QueryPerformanceCounter(&t1);
+    if (begun) {
+        *mrn_miss = tomo_csv_end(&parser);
+    }
+    free(buf);
+    if (!res && begun && tomo_csv_lenient(&parser, &row)) {
+        tomo_logf(TOMO_LOG_WARN, L"CSV: quotes that neither open nor close a field were read as literal characters from data row %zu on",
+                  row + 1);
+    }
+    if (!res) {
+        secs = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+        tomo_logf(TOMO_LOG_INFO, L"CSV: streamed through a %zu KiB buffer at %.2f GB/s (%s tokenizer)",
+                  cap >> 10, (secs > 0) ? *len / secs / 1e9 : 0.0, tomo_csv_tokenizer());
+    }
+    return res;
+}
+
+
+/** @brief Load the file at @p path into @p tbl. A file on disk is mapped, and
+ *      parsed in chunks on as many threads as it is worth. Anything else, such
+ *      as standard input or a pipe, is streamed. The stdio build has no way to
+ *      map files, so it always streams. Whenever the size of the file is known
+ *      up front, @p tbl is sized for the rows estimated from it before
+ *      parsing, which spares most of the rehashing on the way
+ *  @param tbl
+ *      MRN table
+ *  @param path
+ *      Path to file, or "-" for standard input
+ *  @param layout
+ *      Columns to read, resolved from the header here
+ *  @param len
+ *      The number of bytes loaded is written here
+ *  @param mrn_miss
+ *      The number of names without an MRN is written here
+ *  @returns Nonzero on error
+ */
+static int tomo_csv_read(TOMO_MRNTABLE          *tbl,
+                         const wchar_t          *path,
+                         struct tomo_csv_layout *layout,
+                         size_t                 *len,
+                         unsigned               *mrn_miss)
+#if STDC_FILE_IO
+{
+    FILE *fp;
+    int res;
+
+    fp = tomo_csv_open(path);
+    if (!fp) {
+        return 1;
+    }
+    res = tomo_csv_stream(tbl, fp, tomo_csv_size_hint(fp), layout, len, mrn_miss);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return res;
+}
+#else
+{
+    HANDLE hfile;
+    const char *data;
+    size_t skip;
+    int res;
+
+    hfile = tomo_csv_open(path);
+    if (hfile == INVALID_HANDLE_VALUE) {
+        return 1;
+    }
+    if (GetFileType(hfile) != FILE_TYPE_DISK) {
+        /* No size to go by */
+        res = tomo_csv_stream(tbl, hfile, 0, layout, len, mrn_miss);
+    } else {
+        data = NULL;
+        res = tomo_csv_file_size(hfile, len)
+           || !(data = tomo_csv_map(hfile, *len));
+        if (!res) {
+            skip = tomo_csv_resolve(layout, data, *len);
+            tomo_csv_presize(tbl, tomo_csv_estimate(data + skip, *len - skip, *len - skip));
+            res = tomo_csv_parse_chunks(tbl, data + skip, *len - skip, layout, mrn_miss);
+        }
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+    }
+    if (!tomo_csv_is_stdin(path)) {
+        CloseHandle(hfile);
+    }
+    return res;
+}
+#endif
+
+
+/** @brief Log the load time and the peak working set, which is the cost of
+ *      loading that is still visible after the file is released
+ *  @param len
+ *      Size of the file
+ *  @param ms
+ *      Load time in milliseconds
+ */
+static void tomo_csv_log_stats(size_t len, ULONGLONG ms)
+{
+    PROCESS_MEMORY_COUNTERS pmc = { .cb = sizeof pmc };
+    const size_t mib = 1UL << 20;
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc)) {
+        tomo_logf(TOMO_LOG_INFO, L"Loaded %zu MiB of CSV in %llu ms, peak working set %zu MiB",
+                  len / mib, ms, pmc.PeakWorkingSetSize / mib);
+    } else {
+        tomo_logf(TOMO_LOG_INFO, L"Loaded %zu MiB of CSV in %llu ms", len / mib, ms);
+    }
+}
+
+
+int tomo_csv_load(TOMO_MRNTABLE *tbl,
+                  const wchar_t *path,
+                  const wchar_t *name_column,
+                  const wchar_t *mrn_column)
+{
+    struct tomo_csv_layout layout;
+    ULONGLONG start;
+    unsigned mrn_miss;
+    size_t len;
+    int res;
+
+    if (tomo_csv_layout_init(&layout, name_column, mrn_column)
+     || tomo_mrntable_init(tbl, 256)) {
+        return 1;
+    }
+#if !TOMO_CSV_LIBCSV
+    tomo_scan_init();
+#endif
+    start = GetTickCount64();
+    res = tomo_csv_read(tbl, path, &layout, &len, &mrn_miss);
+    if (!res) {
+        if (mrn_miss) {
+            tomo_logf(TOMO_LOG_WARN, L"CSV: %u patients missing IDs", mrn_miss);
+        }
+        tomo_logf(TOMO_LOG_INFO, L"Loaded %u names into %u slots (%u resizes): %zu string allocations, %zu bytes in %zu chunks (%zu reserved)",
+                  tbl->map.load, tbl->map.len, tbl->map.resizes, tbl->arena.nallocs,
+                  tbl->arena.nbytes, tbl->arena.nchunks, tbl->arena.reserved);
+        tomo_csv_log_stats(len, GetTickCount64() - start);
+    }
+    return res;
+}
@@ -1,21 +1,40 @@
-#pragma once
-
-#ifndef TOMOSRV_CSV_H
-#define TOMOSRV_CSV_H
-
-#include "defines.h"
-#include "structures/table.h"
-
-
-/** @brief Load the table data from a CSV file at @p path
- *  @param tbl
- *      MRN table. The memory managed by this object is modified, but assumed to
- *      be externally managed. On failure, you should free this object yourself
- *  @param path
- *      Path to the CSV
- *  @returns Nonzero on error
- */
-int tomo_csv_load(TOMO_MRNTABLE *tbl, const wchar_t *path);
-
-
-#endif /* TOMOSRV_CSV_H */
+#pragma once
+
+#ifndef TOMOSRV_CSV_H
+#define TOMOSRV_CSV_H
+
+#include "defines.h"
+#include "structures/table.h"
+
+
+/** Header of the column of patient names in the MOSAIQ schedule export */
+#define TOMO_CSV_NAMECOL L"Pat_Name"
+
+/** Header of the column of patient IDs in the MOSAIQ schedule export */
+#define TOMO_CSV_MRNCOL L"IDA"
+
+
+/** @brief Load the table data from a CSV file at @p path. The columns read
+ *      are found by their headers in the first row, or if it does not have
+ *      both, are the 24th and 25th as they have always been
+ *  @param tbl
+ *      MRN table. The memory managed by this object is modified, but assumed to
+ *      be externally managed. On failure, you should free this object yourself
+ *  @param path
+ *      Path to the CSV, or "-" to read it from standard input. Files on disk
+ *      are mapped and parsed on several threads, while standard input and
+ *      pipes are streamed through a fixed-size buffer
+ *  @param name_column
+ *      Header of the column of names, matched ignoring case, such as
+ *      TOMO_CSV_NAMECOL
+ *  @param mrn_column
+ *      Header of the column of MRNs, such as TOMO_CSV_MRNCOL
+ *  @returns Nonzero on error
+ */
+int tomo_csv_load(TOMO_MRNTABLE *tbl,
+                  const wchar_t *path,
+                  const wchar_t *name_column,
+                  const wchar_t *mrn_column);
+
+
+#endif /* TOMOSRV_CSV_H */
@@ -1,252 +1,484 @@
-#include <stdio.h>
-
-#include "endpoint.h"
-#include "error.h"
-#include "log.h"
-
-
-void tomo_sockaddr_str(wchar_t *buf, size_t len, const TOMO_SOCKADDR46 *addr)
-{
-    const int fam = addr->gen.sa_family;
-    const void *cp = NULL;
-
-    switch (fam) {
-    case AF_INET:
-        cp = &addr->in4.sin_addr;
-        break;
-    case AF_INET6:
-        cp = &addr->in6.sin6_addr;
-        break;
-    default:
-        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", fam);
-        if (len) {
-            *buf = '\0';
-        }
-        return;
-    }
-    InetNtopW(fam, cp, buf, len);
-}
-
-
-/** @brief Gets the size of the socket address buffer expected by system calls
- *  @param addr
- *      Socket address union
- *  @returns The length in bytes required by the address family currently
- *      contained by @p addr
- */
-static socklen_t tomo_sockaddr_len(const TOMO_SOCKADDR46 *addr)
-{
-    const int af = addr->gen.sa_family;
-
-    switch (af) {
-    case AF_INET:
-        return sizeof addr->in4;
-    case AF_INET6:
-        return sizeof addr->in6;
-    default:
-        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
-        return 0;
-    }
-}
-
-
-/** @brief Sets the socket address to listen to any incoming connection
- *  @param addr
- *      Socket address
- *  @param port
- *      Port to listen on
- */
-static void tomo_sockaddr_any(TOMO_SOCKADDR46 *addr,
-                              u_short          port)
-{
-    const int af = addr->gen.sa_family;
-
-    switch (af) {
-    case AF_INET:
-        addr->in4.sin_addr = in4addr_any;
-        addr->in4.sin_port = htons(port);
-        break;
-    case AF_INET6:
-        addr->in6.sin6_addr = in6addr_any;
-        addr->in6.sin6_port = htons(port);
-        break;
-    default:
-        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
-        break;
-    }
-}
-
-
-static void tomo_sockaddr_set_port(TOMO_SOCKADDR46 *addr,
-                                   u_short          port)
-{
-    const int af = addr->gen.sa_family;
-
-    switch (af) {
-    case AF_INET:
-        addr->in4.sin_port = htons(port);
-        break;
-    case AF_INET6:
-        addr->in6.sin6_port = htons(port);
-        break;
-    default:
-        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
-        break;
-    }
-}
-
-
-int tomo_endpoint_open(TOMO_ENDPOINT *endp, int af, int type, int protocol)
-{
-    static const wchar_t *failmsg = L"Cannot open socket";
-
-    endp->sock = socket(af, type, protocol);
-    if (endp->sock != INVALID_SOCKET) {
-        endp->addr.gen.sa_family = af;
-    } else {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
-    }
-    return endp->sock == INVALID_SOCKET;
-}
-
-
-int tomo_endpoint_dual(TOMO_ENDPOINT *endp)
-{
-    const int val = 0;
-    int res;
-
-    res = setsockopt(endp->sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&val, sizeof val);
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed to apply dual-stacking");
-    }
-    return res;
-}
-
-
-int tomo_endpoint_bind(TOMO_ENDPOINT *endp, u_short port)
-{
-    static const wchar_t *failmsg = L"Cannot bind socket";
-    socklen_t len;
-    int res;
-
-    tomo_sockaddr_any(&endp->addr, port);
-    len = tomo_sockaddr_len(&endp->addr);
-    res = bind(endp->sock, &endp->addr.gen, len);
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
-    }
-    return res;
-}
-
-
-int tomo_endpoint_listen(TOMO_ENDPOINT *endp, int count)
-{
-    static const wchar_t *failmsg = L"Socket cannot listen";
-    int res;
-
-    res = listen(endp->sock, count);
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
-    }
-    return res;
-}
-
-
-int tomo_endpoint_accept(const TOMO_ENDPOINT *serv, TOMO_ENDPOINT *conn)
-{
-    static const wchar_t *failmsg = L"Cannot accept connection";
-    TOMO_SOCKADDR46 addr = { 0 };
-    socklen_t len = sizeof addr;
-    SOCKET sock;
-
-    sock = accept(serv->sock, &addr.gen, &len);
-    if (sock == INVALID_SOCKET) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
-        return 1;
-    }
-    conn->sock = sock;
-    conn->addr = addr;
-    return 0;
-}
-
-
-int tomo_endpoint_connect(TOMO_ENDPOINT *endp,
-                          const char    *host,
-                          const char    *svc,
-                          u_short        port)
-/* This needs to be modified such that it opens the socket too, so that it can
-match the address family returned by getaddrinfo(3) */
-{
-    ADDRINFO hints = {
-        .ai_family   = AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM,
-        .ai_protocol = 0,
-        .ai_flags    = AI_ADDRCONFIG
-    }, *ai, *node;
-    wchar_t ip[65];
-    int res;
-
-    res = getaddrinfo(host, svc, &hints, &ai);
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, &res, L"Failed resolving host %S", host);
-        return 1;
-    }
-    for (node = ai; node; node = node->ai_next) {
-        tomo_sockaddr_str(ip, BUFLEN(ip), (TOMO_SOCKADDR46 *)node->ai_addr);
-        tomo_logf(TOMO_LOG_DEBUG, L"Attempting to connect to %s", ip);
-        if (!svc) {
-            tomo_sockaddr_set_port((TOMO_SOCKADDR46 *)node->ai_addr, port);
-        }
-        res = connect(endp->sock, ai->ai_addr, (int)ai->ai_addrlen);
-        if (!res) {
-            memcpy(&endp->addr, ai->ai_addr, ai->ai_addrlen);
-            break;
-        }
-    }
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed connecting to %S", host);
-    }
-    freeaddrinfo(ai);
-    return res;
-}
-
-
-int tomo_endpoint_recv(TOMO_ENDPOINT *endp, char *buf, size_t *len)
-{
-    wchar_t ip[65];
-    int nread;
-
-    nread = recv(endp->sock, buf, (int)*len, 0);
-    if (nread < 0) {
-        tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed receiving data from %s", ip);
-        return 1;
-    }
-    *len = nread;
-    return 0;
-}
-
-
-int tomo_endpoint_send(TOMO_ENDPOINT *endp, const char *buf, size_t len)
-{
-    wchar_t ip[65];
-    int nread;
-
-    nread = send(endp->sock, buf, (int)len, 0);
-    if (nread < 0) {
-        tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed sending data to %s", ip);
-        return -1;
-    }
-    return nread;
-}
-
-
-int tomo_endpoint_close(TOMO_ENDPOINT *endp)
-{
-    int res;
-    
-    res = closesocket(endp->sock);
-    endp->sock = INVALID_SOCKET;
-    return res;
-}
+#include <stdio.h>
+
+#include "endpoint.h"
+#include "error.h"
+#include "log.h"
+
+
+void tomo_sockaddr_str(wchar_t *buf, size_t len, const TOMO_SOCKADDR46 *addr)
+{
+    const int fam = addr->gen.sa_family;
+    const void *cp = NULL;
+
+    switch (fam) {
+    case AF_INET:
+        cp = &addr->in4.sin_addr;
+        break;
+    case AF_INET6:
+        cp = &addr->in6.sin6_addr;
+        break;
+    case AF_UNIX:
+        /* Clients are usually unnamed, which leaves this empty */
+        if (len) {
+            swprintf(buf, len, L"%.*S", (int)(len - 1), addr->un.sun_path);
+        }
+        return;
+    default:
+        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", fam);
+        if (len) {
+            *buf = '\0';
+        }
+        return;
+    }
+    InetNtopW(fam, cp, buf, len);
+}
+
+
+/** @brief Gets the size of the socket address buffer expected by system calls
+ *  @param addr
+ *      Socket address union
+ *  @returns The length in bytes required by the address family currently
+ *      contained by @p addr
+ */
+static socklen_t tomo_sockaddr_len(const TOMO_SOCKADDR46 *addr)
+{
+    const int af = addr->gen.sa_family;
+
+    switch (af) {
+    case AF_INET:
+        return sizeof addr->in4;
+    case AF_INET6:
+        return sizeof addr->in6;
+    case AF_UNIX:
+        return sizeof addr->un;
+    default:
+        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
+        return 0;
+    }
+}
+
+
+/** @brief Sets the socket address to listen to any incoming connection
+ *  @param addr
+ *      Socket address
+ *  @param port
+ *      Port to listen on
+ */
+static void tomo_sockaddr_any(TOMO_SOCKADDR46 *addr,
+                              u_short          port)
+{
+    const int af = addr->gen.sa_family;
+
+    switch (af) {
+    case AF_INET:
+        addr->in4.sin_addr = in4addr_any;
+        addr->in4.sin_port = htons(port);
+        break;
+    case AF_INET6:
+        addr->in6.sin6_addr = in6addr_any;
+        addr->in6.sin6_port = htons(port);
+        break;
+    default:
+        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
+        break;
+    }
+}
+
+
+static void tomo_sockaddr_set_port(TOMO_SOCKADDR46 *addr,
+                                   u_short          port)
+{
+    const int af = addr->gen.sa_family;
+
+    switch (af) {
+    case AF_INET:
+        addr->in4.sin_port = htons(port);
+        break;
+    case AF_INET6:
+        addr->in6.sin6_port = htons(port);
+        break;
+    default:
+        tomo_logf(TOMO_LOG_ERROR, __FUNCTIONW__ L": Invalid address family %d", af);
+        break;
+    }
+}
+
+
+int tomo_endpoint_open(TOMO_ENDPOINT *endp, int af, int type, int protocol)
+{
+    static const wchar_t *failmsg = L"Cannot open socket";
+
+    endp->sock = socket(af, type, protocol);
+    if (endp->sock != INVALID_SOCKET) {
+        endp->addr.gen.sa_family = af;
+    } else {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
+    }
+    return endp->sock == INVALID_SOCKET;
+}
+
+
+int tomo_endpoint_dual(TOMO_ENDPOINT *endp)
+{
+    const int val = 0;
+    int res;
+
+    res = setsockopt(endp->sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&val, sizeof val);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed to apply dual-stacking");
+    }
+    return res;
+}
+
+
+int tomo_endpoint_nonblock(TOMO_ENDPOINT *endp, bool enable)
+{
+    u_long val = enable;
+    int res;
+
+    res = ioctlsocket(endp->sock, FIONBIO, &val);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Cannot set non-blocking mode");
+    }
+    return res;
+}
+
+
+int tomo_endpoint_nodelay(TOMO_ENDPOINT *endp, bool enable)
+{
+    const BOOL val = enable;
+    int res;
+
+    res = setsockopt(endp->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&val, sizeof val);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Cannot set TCP_NODELAY");
+    }
+    return res;
+}
+
+
+int tomo_endpoint_bind(TOMO_ENDPOINT *endp, u_short port)
+{
+    static const wchar_t *failmsg = L"Cannot bind socket";
+    socklen_t len;
+    int res;
+
+    tomo_sockaddr_any(&endp->addr, port);
+    len = tomo_sockaddr_len(&endp->addr);
+    res = bind(endp->sock, &endp->addr.gen, len);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
+    }
+    return res;
+}
+
+
+/** @brief Check whether @p path is an AF_UNIX socket file
+ *  @param path
+ *      Existing path
+ *  @param is_sock
+ *      The answer is written here
+ *  @returns Nonzero on error
+ */
+static int tomo_endpoint_is_sock(const wchar_t *path, bool *is_sock)
+{
+    FILE_ATTRIBUTE_TAG_INFO info;
+    HANDLE hfile;
+    BOOL ok;
+
+    /* Opening the reparse point itself, rather than whatever it points to */
+    hfile = CreateFileW(path,
+                        FILE_READ_ATTRIBUTES,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
+                        NULL);
+    if (hfile == INVALID_HANDLE_VALUE) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot open %s", path);
+        return 1;
+    }
+    ok = GetFileInformationByHandleEx(hfile, FileAttributeTagInfo, &info, sizeof info);
+    if (!ok) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot query %s", path);
+    }
+    CloseHandle(hfile);
+    *is_sock = ok
+            && (info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            && info.ReparseTag == IO_REPARSE_TAG_AF_UNIX;
+    return !ok;
+}
+
+
+/** @brief Delete the socket file left at the path of @p endp by a server that
+ *      is gone. Nothing else is deleted: a path that is not an AF_UNIX socket,
+ *      or a socket that still takes connections, makes this fail instead
+ *  @param endp
+ *      AF_UNIX endpoint, with its address filled in
+ *  @param path
+ *      Socket path, for messages and deletion
+ *  @returns Nonzero on error
+ */
+static int tomo_endpoint_unlink_stale(const TOMO_ENDPOINT *endp, const wchar_t *path)
+{
+    SOCKET probe;
+    DWORD attrs, err;
+    bool is_sock;
+    int res, wserr;
+
+    attrs = GetFileAttributesW(path);
+    if (attrs == INVALID_FILE_ATTRIBUTES) {
+        err = GetLastError();
+        if (err == ERROR_FILE_NOT_FOUND) {
+            return 0;
+        }
+        tomo_error_raise(TOMO_ERROR_WIN32, &err, L"Cannot check socket path %s", path);
+        return 1;
+    }
+    if (!(attrs & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        is_sock = false;
+    } else if (tomo_endpoint_is_sock(path, &is_sock)) {
+        return 1;
+    }
+    if (!is_sock) {
+        tomo_error_raise(TOMO_ERROR_USER,
+                         L"Something other than a socket is there",
+                         L"Refusing to replace %s",
+                         path);
+        return 1;
+    }
+    /* Only a refused connection says that no server is behind the socket */
+    probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == INVALID_SOCKET) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Cannot probe socket %s", path);
+        return 1;
+    }
+    res = connect(probe, &endp->addr.gen, tomo_sockaddr_len(&endp->addr));
+    wserr = (res) ? WSAGetLastError() : 0;
+    closesocket(probe);
+    if (!res) {
+        tomo_error_raise(TOMO_ERROR_USER,
+                         L"A running server is listening on it",
+                         L"Refusing to replace %s",
+                         path);
+        return 1;
+    }
+    if (wserr != WSAECONNREFUSED) {
+        tomo_error_raise(TOMO_ERROR_SOCK, &wserr, L"Cannot probe socket %s", path);
+        return 1;
+    }
+    if (!DeleteFileW(path)) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot delete stale socket %s", path);
+        return 1;
+    }
+    tomo_logf(TOMO_LOG_INFO, L"Deleted stale socket %s", path);
+    return 0;
+}
+
+
+int tomo_endpoint_bind_path(TOMO_ENDPOINT *endp, const wchar_t *path)
+{
+    static const wchar_t *failmsg = L"Cannot bind socket to %s";
+    struct sockaddr_un *const un = &endp->addr.un;
+    int res;
+
+    res = WideCharToMultiByte(CP_UTF8,
+                              0,
+                              path,
+                              -1,
+                              un->sun_path,
+                              sizeof un->sun_path,
+                              NULL,
+                              NULL);
+    if (!res) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Invalid socket path %s", path);
+        return 1;
+    }
+    if (tomo_endpoint_unlink_stale(endp, path)) {
+        return 1;
+    }
+    res = bind(endp->sock, &endp->addr.gen, tomo_sockaddr_len(&endp->addr));
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg, path);
+    }
+    return res;
+}
+
+
+int tomo_endpoint_listen(TOMO_ENDPOINT *endp, int count)
+{
+    static const wchar_t *failmsg = L"Socket cannot listen";
+    int res;
+
+    res = listen(endp->sock, count);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, failmsg);
+    }
+    return res;
+}
+
+
+int tomo_endpoint_accept(const TOMO_ENDPOINT *serv, TOMO_ENDPOINT *conn)
+{
+    static const wchar_t *failmsg = L"Cannot accept connection";
+    TOMO_SOCKADDR46 addr = { 0 };
+    socklen_t len = sizeof addr;
+    SOCKET sock;
+    int err;
+
+    sock = accept(serv->sock, &addr.gen, &len);
+    if (sock == INVALID_SOCKET) {
+        err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) {
+            return 1;
+        }
+        tomo_error_raise(TOMO_ERROR_SOCK, &err, failmsg);
+        return -1;
+    }
+    conn->sock = sock;
+    conn->addr = addr;
+    return 0;
+}
+
+
+int tomo_endpoint_connect(TOMO_ENDPOINT *endp,
+                          const char    *host,
+                          const char    *svc,
+                          u_short        port)
+/* This needs to be modified such that it opens the socket too, so that it can
+match the address family returned by getaddrinfo(3) */
+{
+    ADDRINFO hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = 0,
+        .ai_flags    = AI_ADDRCONFIG
+    }, *ai, *node;
+    wchar_t ip[65];
+    int res;
+
+    res = getaddrinfo(host, svc, &hints, &ai);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, &res, L"Failed resolving host %S", host);
+        return 1;
+    }
+    for (node = ai; node; node = node->ai_next) {
+        tomo_sockaddr_str(ip, BUFLEN(ip), (TOMO_SOCKADDR46 *)node->ai_addr);
+        tomo_logf(TOMO_LOG_DEBUG, L"Attempting to connect to %s", ip);
+        if (!svc) {
+            tomo_sockaddr_set_port((TOMO_SOCKADDR46 *)node->ai_addr, port);
+        }
+        res = connect(endp->sock, ai->ai_addr, (int)ai->ai_addrlen);
+        if (!res) {
+            memcpy(&endp->addr, ai->ai_addr, ai->ai_addrlen);
+            break;
+        }
+    }
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed connecting to %S", host);
+    }
+    freeaddrinfo(ai);
+    return res;
+}
+
+
+int tomo_endpoint_recv(TOMO_ENDPOINT *endp, char *buf, size_t *len)
+{
+    wchar_t ip[65];
+    int nread, err;
+
+    nread = recv(endp->sock, buf, (int)*len, 0);
+    if (nread < 0) {
+        err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) {
+            return 1;
+        }
+        tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
+        tomo_error_raise(TOMO_ERROR_SOCK, &err, L"Failed receiving data from %s", ip);
+        return -1;
+    }
+    *len = nread;
+    return 0;
+}
+
+
+int tomo_endpoint_send(TOMO_ENDPOINT *endp, const char *buf, size_t len)
+{
+    wchar_t ip[65];
+    int nread, err;
+
+    nread = send(endp->sock, buf, (int)len, 0);
+    if (nread < 0) {
+        err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) {
+            return 0;
+        }
+        tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
+        tomo_error_raise(TOMO_ERROR_SOCK, &err, L"Failed sending data to %s", ip);
+        return -1;
+    }
+    return nread;
+}
+
+
+int tomo_endpoint_recvfrom(TOMO_ENDPOINT   *endp,
+                           char            *buf,
+                           size_t          *len,
+                           TOMO_SOCKADDR46 *from)
+{
+    socklen_t addrlen;
+    int nread, err;
+
+    do {
+        addrlen = sizeof *from;
+        nread = recvfrom(endp->sock, buf, (int)*len, 0, &from->gen, &addrlen);
+        /* WSAECONNRESET reports an ICMP port unreachable for some earlier
+        sendto, not anything wrong with the datagram being received */
+        err = (nread < 0) ? WSAGetLastError() : 0;
+    } while (err == WSAECONNRESET);
+    if (err) {
+        if (err == WSAEWOULDBLOCK) {
+            return 1;
+        }
+        tomo_error_raise(TOMO_ERROR_SOCK, &err, L"Failed receiving datagram");
+        return -1;
+    }
+    *len = nread;
+    return 0;
+}
+
+
+int tomo_endpoint_sendto(TOMO_ENDPOINT         *endp,
+                         const char            *buf,
+                         size_t                 len,
+                         const TOMO_SOCKADDR46 *to)
+{
+    wchar_t ip[65];
+    int res, err;
+
+    res = sendto(endp->sock, buf, (int)len, 0, &to->gen, tomo_sockaddr_len(to));
+    if (res < 0) {
+        err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK) {
+            return 0;
+        }
+        tomo_sockaddr_str(ip, BUFLEN(ip), to);
+        tomo_error_raise(TOMO_ERROR_SOCK, &err, L"Failed sending datagram to %s", ip);
+        return 1;
+    }
+    return 0;
+}
+
+
+int tomo_endpoint_close(TOMO_ENDPOINT *endp)
+{
+    int res;
+    
+    res = closesocket(endp->sock);
+    endp->sock = INVALID_SOCKET;
+    if (endp->dtor) {
+        endp->dtor(endp, endp->data);
+        endp->dtor = NULL;
+    }
+    return res;
+}
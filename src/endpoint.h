@@ -5,12 +5,14 @@
 
 #include "defines.h"
 #include <ws2tcpip.h>
+#include <afunix.h>
 
 
 typedef union tomo_sockaddr46 {
     struct sockaddr     gen;
     struct sockaddr_in  in4;
     struct sockaddr_in6 in6;
+    struct sockaddr_un  un;     /* AF_UNIX, for local listeners */
 } TOMO_SOCKADDR46;
 
 
@@ -36,9 +38,15 @@ typedef struct tomo_endpoint {
     TOMO_SOCKADDR46 addr;
     SOCKET sock;
 
+    SHORT events;   /* Poll events this endpoint is interested in */
+    SHORT revents;  /* Events that triggered the current callback */
+
     /** STRONGly consider making the poll callba% part of the endpoint */
     int (*proc)(struct tomo_endpoint *endp, void *data);
     void *data;
+
+    /** If not NULL, called by tomo_endpoint_close to release @p data */
+    void (*dtor)(struct tomo_endpoint *endp, void *data);
 } TOMO_ENDPOINT;
 
 
@@ -64,6 +72,29 @@ int tomo_endpoint_open(TOMO_ENDPOINT *endp, int af, int type, int protocol);
 int tomo_endpoint_dual(TOMO_ENDPOINT *endp);
 
 
+/** @brief Switch the socket contained by @p endp between blocking and
+ *      non-blocking mode
+ *  @param endp
+ *      Endpoint
+ *  @param enable
+ *      true for non-blocking mode, false for blocking mode
+ *  @returns Nonzero on error
+ */
+int tomo_endpoint_nonblock(TOMO_ENDPOINT *endp, bool enable);
+
+
+/** @brief Turn Nagle's algorithm off (or back on) for the TCP socket contained
+ *      by @p endp. Replies are written whole, so there is nothing to gain by
+ *      holding them back for coalescing
+ *  @param endp
+ *      Endpoint
+ *  @param enable
+ *      true to send segments immediately (TCP_NODELAY), false for Nagle
+ *  @returns Nonzero on error
+ */
+int tomo_endpoint_nodelay(TOMO_ENDPOINT *endp, bool enable);
+
+
 /** @brief Bind @p endp to @p port
  *  @param endp
  *      Endpoint
@@ -74,11 +105,25 @@ int tomo_endpoint_dual(TOMO_ENDPOINT *endp);
 int tomo_endpoint_bind(TOMO_ENDPOINT *endp, u_short port);
 
 
+/** @brief Bind the AF_UNIX endpoint @p endp to the filesystem path @p path. A
+ *      socket file at @p path is deleted first if no server accepts on it
+ *      anymore. Anything else there, be it another kind of file or a socket
+ *      still in use, fails the bind
+ *  @param endp
+ *      Endpoint
+ *  @param path
+ *      Socket path. It must fit in sun_path once converted to UTF-8
+ *  @returns Nonzero on error
+ */
+int tomo_endpoint_bind_path(TOMO_ENDPOINT *endp, const wchar_t *path);
+
+
 /** @brief Begin listening on the socket contained by @p endp
  *  @param endp
  *      Endpoint
  *  @param count
- *      Connection buffer size
+ *      Connection buffer size. SOMAXCONN gets the provider's default, and
+ *      SOMAXCONN_HINT(n) asks for n outright
  *  @returns Nonzero on error
  */
 int tomo_endpoint_listen(TOMO_ENDPOINT *endp, int count);
@@ -90,7 +135,8 @@ int tomo_endpoint_listen(TOMO_ENDPOINT *endp, int count);
  *      Listening endpoint
  *  @param conn
  *      The connection details will be written here
- *  @returns Nonzero on error, including EWOULDBLOCK!
+ *  @returns Negative on error, positive if @p serv is non-blocking and there
+ *      was no connection to accept (no error state is raised for this)
  */
 int tomo_endpoint_accept(const TOMO_ENDPOINT *serv, TOMO_ENDPOINT *conn);
 
@@ -120,7 +166,8 @@ int tomo_endpoint_connect(TOMO_ENDPOINT *endp,
  *  @param[in,out] len
  *      On input, the maximum size of @p buf. On output the number of characters
  *      written to the buffer if there was no error
- *  @returns Nonzero on error
+ *  @returns Negative on error, positive if the socket is non-blocking and no
+ *      data was available (no error state is raised for this), zero otherwise
  */
 int tomo_endpoint_recv(TOMO_ENDPOINT *endp, char *buf, size_t *len);
 
@@ -132,11 +179,49 @@ int tomo_endpoint_recv(TOMO_ENDPOINT *endp, char *buf, size_t *len);
  *      Buffer to send
  *  @param len
  *      Number of bytes in @p buf to send
- *  @returns Negative on error, the number of bytes sent on success
+ *  @returns Negative on error, the number of bytes sent on success. This may be
+ *      less than @p len (or zero) if the socket is non-blocking
  */
 int tomo_endpoint_send(TOMO_ENDPOINT *endp, const char *buf, size_t len);
 
 
+/** @brief Receive one datagram on @p endp
+ *  @param endp
+ *      Datagram endpoint
+ *  @param buf
+ *      Destination buffer
+ *  @param[in,out] len
+ *      On input, the maximum size of @p buf. On output the length of the
+ *      datagram if there was no error
+ *  @param from
+ *      The sender's address is written here
+ *  @returns Negative on error, positive if the socket is non-blocking and no
+ *      datagram was waiting (no error state is raised for this), zero otherwise
+ */
+int tomo_endpoint_recvfrom(TOMO_ENDPOINT   *endp,
+                           char            *buf,
+                           size_t          *len,
+                           TOMO_SOCKADDR46 *from);
+
+
+/** @brief Send one datagram from @p endp to @p to
+ *  @param endp
+ *      Datagram endpoint
+ *  @param buf
+ *      Datagram contents
+ *  @param len
+ *      Length of @p buf
+ *  @param to
+ *      Destination address
+ *  @returns Nonzero on error. A datagram the (non-blocking) socket has no room
+ *      for is dropped without error, as the network might have done anyway
+ */
+int tomo_endpoint_sendto(TOMO_ENDPOINT         *endp,
+                         const char            *buf,
+                         size_t                 len,
+                         const TOMO_SOCKADDR46 *to);
+
+
 /** @brief Executes this endpoint's associated function
  *  @param endp
  *      Endpoint
@@ -149,7 +234,7 @@ static inline int tomo_endpoint_exec(TOMO_ENDPOINT *endp)
 
 
 /** @brief Close the socket. This operation invalidates the contained SOCKET
- *      handle
+ *      handle, and runs the endpoint's destructor if it has one
  *  @param endp
  *      Endpoint to close
  *  @warning This function propagates the return value from the syscall, but
@@ -1,151 +1,221 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "multiplex.h"
-#include "error.h"
-#include "log.h"
-
-
-/** @brief realloc(3) wrapper for propagating error states more simply
- *  @param ptr
- *      Address of pointer to block being reallocated
- *  @param newsize
- *      Size passed to realloc(3)
- *  @returns Nonzero on error
- */
-static int tomo_multiplexer_realloc(void **ptr, size_t newsize)
-{
-    void *newptr;
-
-    newptr = realloc(*ptr, newsize);
-    if (!newptr) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Cannot reallocate multiplexer");
-        return 1;
-    }
-    *ptr = newptr;
-    return 0;
-}
-
-
-int tomo_multiplexer_reserve(TOMO_MULTIPLEXER *muxer, ULONG newsize)
-{
-    ULONG newcap = muxer->cap;
-    size_t datalen, fdslen;
-
-    if (newcap >= newsize) {
-        return 0;
-    }
-    do {
-        newcap = newcap * 2 + 1;
-    } while (newcap < newsize);
-    datalen = sizeof *muxer->endpts * newcap;
-    fdslen = sizeof *muxer->fds * newcap;
-    if (tomo_multiplexer_realloc((void **)&muxer->endpts, datalen)
-     || tomo_multiplexer_realloc((void **)&muxer->fds, fdslen)) {
-        return 1;
-    }
-    muxer->cap = newcap;
-    return 0;
-}
-
-
-int tomo_multiplexer_add(TOMO_MULTIPLEXER   *muxer,
-                         ULONG               nfds,
-                         const TOMO_ENDPOINT endpts[],
-                         const SHORT         evts[])
-{
-    ULONG need = muxer->size + nfds;
-    unsigned i;
-
-    if (tomo_multiplexer_reserve(muxer, need)) {
-        return 1;
-    }
-    for (i = 0; i < nfds; i++) {
-        muxer->endpts[muxer->size + i] = endpts[i];
-        muxer->fds[muxer->size + i].fd = endpts[i].sock;
-        muxer->fds[muxer->size + i].events = evts[i];
-    }
-    muxer->size += nfds;
-    return 0;
-}
-
-
-void tomo_multiplexer_close(TOMO_MULTIPLEXER *muxer, unsigned idx)
-{
-    const unsigned end = --muxer->size;
-    wchar_t ip[65];
-
-    tomo_sockaddr_str(ip, BUFLEN(ip), &muxer->endpts[idx].addr);
-    tomo_logf(TOMO_LOG_INFO, L"Closing connection from %s", ip);
-    tomo_endpoint_close(&muxer->endpts[idx]);
-    memmove(&muxer->endpts[idx], &muxer->endpts[end], sizeof *muxer->endpts);
-    memmove(&muxer->fds[idx], &muxer->fds[end], sizeof *muxer->fds);
-}
-
-
-/** hack */
-static bool evt_has_data(SHORT evt)
-{
-    return evt & POLLERR || evt & POLLHUP || evt & POLLIN;
-}
-
-
-/** @brief Checks all file descriptors and invokes the relevant callbacks
- *  @param muxer
- *      Multiplexer
- */
-static void tomo_multiplexer_update(TOMO_MULTIPLEXER *muxer)
-{
-    unsigned i;
-    SHORT evt;
-    int res;
-
-    for (i = 0; i < muxer->size; i++) {
-        evt = muxer->fds[i].revents;
-        if (!evt) {
-            continue;
-        }
-        if (evt_has_data(evt)) {
-            res = tomo_endpoint_exec(&muxer->endpts[i]);
-            switch (res) {
-            case TOMO_ENDPT_ERROR:
-                tomo_log_error(TOMO_LOG_ERROR);
-                tomo_error_raise(TOMO_ERROR_NONE, NULL, NULL);
-                /* FALL THRU */
-            case TOMO_ENDPT_CLOSED:
-                tomo_multiplexer_close(muxer, i--);
-                /* FALL THRU */
-            default:
-                break;
-            }
-        }
-    }
-}
-
-
-int tomo_multiplexer_poll(TOMO_MULTIPLEXER *muxer, int timeout)
-{
-    int res;
-
-    res = WSAPoll(muxer->fds, muxer->size, timeout);
-    if (res < 0) {
-        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed polling sockets");
-        return 1;
-    } else if (res) {
-        tomo_multiplexer_update(muxer);
-    }
-    return 0;
-}
-
-
-void tomo_multiplexer_clear(TOMO_MULTIPLEXER *muxer)
-{
-    static const TOMO_MULTIPLEXER zero = { 0 };
-    unsigned i;
-
-    for (i = 0; i < muxer->size; i++) {
-        tomo_endpoint_close(&muxer->endpts[i]);
-    }
-    free(muxer->endpts);
-    free(muxer->fds);
-    *muxer = zero;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplex.h"
+#include "error.h"
+#include "log.h"
+
+
+/** @brief realloc(3) wrapper for propagating error states more simply
+ *  @param ptr
+ *      Address of pointer to block being reallocated
+ *  @param newsize
+ *      Size passed to realloc(3)
+ *  @returns Nonzero on error
+ */
+static int tomo_multiplexer_realloc(void **ptr, size_t newsize)
+{
+    void *newptr;
+
+    newptr = realloc(*ptr, newsize);
+    if (!newptr) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Cannot reallocate multiplexer");
+        return 1;
+    }
+    *ptr = newptr;
+    return 0;
+}
+
+
+/** Endpoint slab slot. pos is the endpoint's index in the poll array */
+struct tomo_muxslot {
+    TOMO_ENDPOINT endp;
+    ULONG pos;
+};
+
+
+int tomo_multiplexer_reserve(TOMO_MULTIPLEXER *muxer, ULONG newsize)
+{
+    ULONG newcap = muxer->cap;
+    size_t hndlen, fdslen;
+
+    if (newcap >= newsize) {
+        return 0;
+    }
+    do {
+        newcap = newcap * 2 + 1;
+    } while (newcap < newsize);
+    hndlen = sizeof *muxer->hndls * newcap;
+    fdslen = sizeof *muxer->fds * newcap;
+    if (tomo_multiplexer_realloc((void **)&muxer->hndls, hndlen)
+     || tomo_multiplexer_realloc((void **)&muxer->fds, fdslen)) {
+        return 1;
+    }
+    muxer->cap = newcap;
+    return 0;
+}
+
+
+int tomo_multiplexer_add(TOMO_MULTIPLEXER   *muxer,
+                         ULONG               nfds,
+                         const TOMO_ENDPOINT endpts[],
+                         TOMO_HANDLE         hndls[])
+{
+    struct tomo_muxslot *slot;
+    TOMO_HANDLE hndl;
+    unsigned i;
+
+    if (tomo_multiplexer_reserve(muxer, muxer->size + nfds)) {
+        return 1;
+    }
+    if (!muxer->slots.stride) {
+        tomo_slab_init(&muxer->slots, sizeof *slot);
+    }
+    for (i = 0; i < nfds; i++) {
+        slot = tomo_slab_alloc(&muxer->slots, &hndl);
+        if (!slot) {
+            return 1;
+        }
+        slot->endp = endpts[i];
+        slot->pos = muxer->size;
+        muxer->hndls[muxer->size] = hndl;
+        muxer->fds[muxer->size].fd = endpts[i].sock;
+        muxer->fds[muxer->size].events = endpts[i].events;
+        muxer->fds[muxer->size].revents = 0;
+        muxer->size++;
+        if (hndls) {
+            hndls[i] = hndl;
+        }
+    }
+    return 0;
+}
+
+
+TOMO_ENDPOINT *tomo_multiplexer_get(const TOMO_MULTIPLEXER *muxer,
+                                    TOMO_HANDLE             hndl)
+{
+    struct tomo_muxslot *slot;
+
+    slot = tomo_slab_get(&muxer->slots, hndl);
+    return (slot) ? &slot->endp : NULL;
+}
+
+
+void tomo_multiplexer_remove(TOMO_MULTIPLEXER *muxer, TOMO_HANDLE hndl)
+{
+    struct tomo_muxslot *slot, *last;
+    ULONG end;
+
+    slot = tomo_slab_get(&muxer->slots, hndl);
+    if (!slot) {
+        return;
+    }
+    /* Keep the poll array dense by moving the last entry into the hole */
+    end = --muxer->size;
+    if (slot->pos != end) {
+        muxer->hndls[slot->pos] = muxer->hndls[end];
+        muxer->fds[slot->pos] = muxer->fds[end];
+        last = tomo_slab_get(&muxer->slots, muxer->hndls[end]);
+        last->pos = slot->pos;
+    }
+    tomo_slab_release(&muxer->slots, hndl);
+}
+
+
+void tomo_multiplexer_close(TOMO_MULTIPLEXER *muxer, TOMO_HANDLE hndl)
+{
+    TOMO_ENDPOINT *endp;
+    wchar_t ip[65];
+
+    endp = tomo_multiplexer_get(muxer, hndl);
+    if (!endp) {
+        return;
+    }
+    tomo_sockaddr_str(ip, BUFLEN(ip), &endp->addr);
+    tomo_logf(TOMO_LOG_INFO, L"Closing connection from %s", ip);
+    tomo_endpoint_close(endp);
+    tomo_multiplexer_remove(muxer, hndl);
+}
+
+
+/** hack */
+static bool evt_has_data(SHORT evt)
+{
+    return evt & POLLERR || evt & POLLHUP || evt & POLLIN || evt & POLLOUT;
+}
+
+
+/** @brief Checks file descriptors and invokes the relevant callbacks. The scan
+ *      stops once @p nready signaled sockets have been visited, so a wakeup
+ *      caused by one active client does not walk every idle connection
+ *  @param muxer
+ *      Multiplexer
+ *  @param nready
+ *      Number of sockets with nonzero revents, as returned by WSAPoll
+ */
+static void tomo_multiplexer_update(TOMO_MULTIPLEXER *muxer, int nready)
+{
+    struct tomo_muxslot *slot;
+    TOMO_HANDLE hndl;
+    unsigned i;
+    SHORT evt;
+    int res;
+
+    for (i = 0; nready && i < muxer->size; i++) {
+        evt = muxer->fds[i].revents;
+        if (!evt) {
+            continue;
+        }
+        muxer->fds[i].revents = 0;
+        nready--;
+        if (evt_has_data(evt)) {
+            hndl = muxer->hndls[i];
+            slot = tomo_slab_get(&muxer->slots, hndl);
+            slot->endp.revents = evt;
+            res = tomo_endpoint_exec(&slot->endp);
+            switch (res) {
+            case TOMO_ENDPT_ERROR:
+                tomo_log_error(TOMO_LOG_ERROR);
+                tomo_error_raise(TOMO_ERROR_NONE, NULL, NULL);
+                /* FALL THRU */
+            case TOMO_ENDPT_CLOSED:
+                tomo_multiplexer_close(muxer, hndl);
+                i--;
+                break;
+            default:
+                /* The callback may have changed its interest set */
+                muxer->fds[slot->pos].events = slot->endp.events;
+                break;
+            }
+        }
+    }
+}
+
+
+int tomo_multiplexer_poll(TOMO_MULTIPLEXER *muxer, int timeout)
+{
+    int res;
+
+    res = WSAPoll(muxer->fds, muxer->size, timeout);
+    if (res < 0) {
+        tomo_error_raise(TOMO_ERROR_SOCK, NULL, L"Failed polling sockets");
+        return 1;
+    } else if (res) {
+        tomo_multiplexer_update(muxer, res);
+    }
+    return 0;
+}
+
+
+void tomo_multiplexer_clear(TOMO_MULTIPLEXER *muxer)
+{
+    static const TOMO_MULTIPLEXER zero = { 0 };
+    unsigned i;
+
+    for (i = 0; i < muxer->size; i++) {
+        tomo_endpoint_close(tomo_multiplexer_get(muxer, muxer->hndls[i]));
+    }
+    tomo_slab_free(&muxer->slots, NULL);
+    free(muxer->hndls);
+    free(muxer->fds);
+    *muxer = zero;
+}
@@ -1,78 +1,110 @@
-#pragma once
-
-#ifndef TOMOSRV_MULTIPLEX_H
-#define TOMOSRV_MULTIPLEX_H
-
-#include "defines.h"
-#include "endpoint.h"
-#include <winsock2.h>
-
-
-/** Zero-initialize this. This interface relies upon standard-guaranteed
- *  behavior involving NULL pointers
- */
-typedef struct tomo_multiplexer {
-    ULONG size, cap;
-
-    TOMO_ENDPOINT *endpts;
-
-    WSAPOLLFD *fds;
-} TOMO_MULTIPLEXER;
-
-
-/** @brief Reserve at least @p newsize elements in @p muxer
- *  @param muxer
- *      Multiplexer
- *  @param newsize
- *      Minimum required size
- *  @returns Nonzero on error
- */
-int tomo_multiplexer_reserve(TOMO_MULTIPLEXER *muxer, ULONG newsize);
-
-
-/** @brief Add @p nfds sockets to the multiplexer
- *  @param muxer
- *      Multiplexer
- *  @param nfds
- *      Number of sockets to add
- *  @param endpts
- *      Pointer to array of endpoints to be copied in
- *  @param evts
- *      Pointer to array of requested return events
- *  @returns Nonzero on error
- */
-int tomo_multiplexer_add(TOMO_MULTIPLEXER   *muxer,
-                         ULONG               nfds,
-                         const TOMO_ENDPOINT endpts[],
-                         const SHORT         evts[]);
-
-
-/** @brief Close the socket associated with @p idx
- *  @param muxer
- *      Multiplexer
- *  @param idx
- *      Index of the socket to be closed
- */
-void tomo_multiplexer_close(TOMO_MULTIPLEXER *muxer, unsigned idx);
-
-
-/** @brief Poll the multiplexer
- *  @param muxer
- *      Multiplexer
- *  @param timeout
- *      Timeout parameter passed directly to poll(2) (WSAPoll(2))
- *  @returns Nonzero on error. Errors from callbacks are not propagated, do your
- *      own error handling therein
- */
-int tomo_multiplexer_poll(TOMO_MULTIPLEXER *muxer, int timeout);
-
-
-/** @brief Frees all memory held by @p muxer and zeroes it
- *  @param muxer
- *      Multiplexer. This must have been zero-initialized or modified only
- *      through previous calls to this interface
- */
-void tomo_multiplexer_clear(TOMO_MULTIPLEXER *muxer);
-
-
-#endif /* TOMOSRV_MULTIPLEX_H */
+#pragma once
+
+#ifndef TOMOSRV_MULTIPLEX_H
+#define TOMOSRV_MULTIPLEX_H
+
+#include "defines.h"
+#include "endpoint.h"
+#include "structures/slab.h"
+#include <winsock2.h>
+
+
+/** Zero-initialize this. This interface relies upon standard-guaranteed
+ *  behavior involving NULL pointers
+ *
+ *  Endpoints live in a slab and never move, so pointers to them stay valid
+ *  until they are closed. The poll array is kept dense, and each entry is
+ *  paired with the handle of the endpoint it belongs to
+ */
+typedef struct tomo_multiplexer {
+    ULONG size, cap;
+
+    TOMO_HANDLE *hndls;
+
+    WSAPOLLFD *fds;
+
+    TOMO_SLAB slots;
+} TOMO_MULTIPLEXER;
+
+
+/** @brief Reserve at least @p newsize elements in @p muxer
+ *  @param muxer
+ *      Multiplexer
+ *  @param newsize
+ *      Minimum required size
+ *  @returns Nonzero on error
+ */
+int tomo_multiplexer_reserve(TOMO_MULTIPLEXER *muxer, ULONG newsize);
+
+
+/** @brief Add @p nfds sockets to the multiplexer
+ *  @param muxer
+ *      Multiplexer
+ *  @param nfds
+ *      Number of sockets to add
+ *  @param endpts
+ *      Pointer to array of endpoints to be copied in. Each endpoint's events
+ *      field is its initial interest set
+ *  @param hndls
+ *      If not NULL, the handle of each added endpoint is written here
+ *  @returns Nonzero on error
+ */
+int tomo_multiplexer_add(TOMO_MULTIPLEXER   *muxer,
+                         ULONG               nfds,
+                         const TOMO_ENDPOINT endpts[],
+                         TOMO_HANDLE         hndls[]);
+
+
+/** @brief Resolve an endpoint handle
+ *  @param muxer
+ *      Multiplexer
+ *  @param hndl
+ *      Handle returned by tomo_multiplexer_add
+ *  @returns A pointer to the endpoint, or NULL if it has since been removed
+ */
+TOMO_ENDPOINT *tomo_multiplexer_get(const TOMO_MULTIPLEXER *muxer,
+                                    TOMO_HANDLE             hndl);
+
+
+/** @brief Remove the socket at @p hndl from the multiplexer without closing it.
+ *      Use this for sockets that are shared between several multiplexers
+ *  @param muxer
+ *      Multiplexer
+ *  @param hndl
+ *      Handle of the socket to be removed. Stale handles are ignored
+ */
+void tomo_multiplexer_remove(TOMO_MULTIPLEXER *muxer, TOMO_HANDLE hndl);
+
+
+/** @brief Close the socket associated with @p hndl
+ *  @param muxer
+ *      Multiplexer
+ *  @param hndl
+ *      Handle of the socket to be closed. Stale handles are ignored
+ */
+void tomo_multiplexer_close(TOMO_MULTIPLEXER *muxer, TOMO_HANDLE hndl);
+
+
+/** @brief Poll the multiplexer. Before an endpoint's callback runs, its revents
+ *      field is set to the returned events. Afterwards its events field is
+ *      copied back to the poll set, so callbacks change their interest (e.g.
+ *      POLLOUT while output is queued) by writing endp->events
+ *  @param muxer
+ *      Multiplexer
+ *  @param timeout
+ *      Timeout parameter passed directly to poll(2) (WSAPoll(2))
+ *  @returns Nonzero on error. Errors from callbacks are not propagated, do your
+ *      own error handling therein
+ */
+int tomo_multiplexer_poll(TOMO_MULTIPLEXER *muxer, int timeout);
+
+
+/** @brief Frees all memory held by @p muxer and zeroes it
+ *  @param muxer
+ *      Multiplexer. This must have been zero-initialized or modified only
+ *      through previous calls to this interface
+ */
+void tomo_multiplexer_clear(TOMO_MULTIPLEXER *muxer);
+
+
+#endif /* TOMOSRV_MULTIPLEX_H */
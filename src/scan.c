@@ -0,0 +1,575 @@
+#include <string.h>
+
+#include "scan.h"
+
+#include <intrin.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#   define TOMO_SCAN_SIMD 1
+#   include <immintrin.h>
+#else
+#   define TOMO_SCAN_SIMD 0
+#endif
+
+/** Bytes classified at once, one bit of each mask per byte */
+#define TOMO_SCAN_BLOCK 64
+
+
+/** The bytes of one block that tokenizing cares about */
+typedef struct tomo_scanmasks {
+    unsigned long long quotes;
+    unsigned long long commas;
+    unsigned long long newlines;    /* CR or LF */
+} TOMO_SCANMASKS;
+
+
+typedef void TOMO_SCANPROC(const char *block, TOMO_SCANMASKS *m);
+
+
+/** @brief Portable classifier, a byte at a time */
+static void tomo_scan_classify(const char *block, TOMO_SCANMASKS *m)
+{
+    unsigned long long bit;
+    unsigned i;
+
+    m->quotes = m->commas = m->newlines = 0;
+    for (i = 0; i < TOMO_SCAN_BLOCK; i++) {
+        bit = 1ULL << i;
+        switch (block[i]) {
+        case '"':
+            m->quotes |= bit;
+            break;
+        case ',':
+            m->commas |= bit;
+            break;
+        case '\n':
+        case '\r':
+            m->newlines |= bit;
+            break;
+        }
+    }
+}
+
+
+#if TOMO_SCAN_SIMD
+/** @brief SSE2 classifier, 16 bytes at a time */
+static void tomo_scan_classify_sse2(const char *block, TOMO_SCANMASKS *m)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    unsigned long long mask;
+    __m128i v;
+    unsigned i;
+
+    m->quotes = m->commas = m->newlines = 0;
+    for (i = 0; i < TOMO_SCAN_BLOCK; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(block + i));
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+        m->quotes |= mask << i;
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+        m->commas |= mask << i;
+        mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                                        _mm_cmpeq_epi8(v, cr)));
+        m->newlines |= mask << i;
+    }
+}
+
+
+/** @brief AVX2 classifier, 32 bytes at a time */
+static void tomo_scan_classify_avx2(const char *block, TOMO_SCANMASKS *m)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    unsigned long long mask;
+    __m256i v;
+    unsigned i;
+
+    m->quotes = m->commas = m->newlines = 0;
+    for (i = 0; i < TOMO_SCAN_BLOCK; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(block + i));
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+        m->quotes |= mask << i;
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma));
+        m->commas |= mask << i;
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+                                                              _mm256_cmpeq_epi8(v, cr)));
+        m->newlines |= mask << i;
+    }
+}
+#endif
+
+
+static TOMO_SCANPROC *tomo_scan_proc = tomo_scan_classify;
+static const wchar_t *tomo_scan_desc = L"scalar";
+
+
+void tomo_scan_init(void)
+{
+#if TOMO_SCAN_SIMD
+    int info[4];
+    unsigned maxleaf;
+
+    tomo_scan_proc = tomo_scan_classify_sse2;
+    tomo_scan_desc = L"SSE2";
+    __cpuid(info, 0);
+    maxleaf = info[0];
+    __cpuid(info, 1);
+    /* AVX registers are only usable if the OS saves them (OSXSAVE, then the
+    XMM and YMM bits of XCR0) */
+    if (maxleaf >= 7
+     && (info[2] & (1 << 27)) && (info[2] & (1 << 28))
+     && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            tomo_scan_proc = tomo_scan_classify_avx2;
+            tomo_scan_desc = L"AVX2";
+        }
+    }
+#endif
+}
+
+
+const wchar_t *tomo_scan_name(void)
+{
+    return tomo_scan_desc;
+}
+
+
+/** @brief Get the index of the lowest set bit of nonzero @p mask */
+static unsigned tomo_scan_ctz(unsigned long long mask)
+{
+    unsigned long idx;
+
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanForward64(&idx, mask);
+#else
+    if (!_BitScanForward(&idx, (unsigned long)mask)) {
+        _BitScanForward(&idx, (unsigned long)(mask >> 32));
+        idx += 32;
+    }
+#endif
+    return idx;
+}
+
+
+/** @brief Set every bit of @p x that has an odd number of set bits at or below
+ *      it. Over the quotes of a block, that marks each quoted stretch from its
+ *      opening quote up to (not including) its closing one. A doubled quote
+ *      closes and reopens, so escapes need no special care
+ */
+static unsigned long long tomo_scan_prefix_xor(unsigned long long x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+
+/** @brief Check for the whitespace trimmed around fields */
+static bool tomo_scan_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+
+/** @brief Check for a byte that ends a field outside of quotes */
+static bool tomo_scan_sep(char c)
+{
+    return c == ',' || c == '\n' || c == '\r';
+}
+
+
+/** @brief Check that every quote of a block opens or closes a field. An
+ *      opening quote must start its field, after any spaces, or directly
+ *      follow the quote it escapes. A closing quote must end its field, before
+ *      any spaces, or directly precede the quote it escapes
+ *  @param buf
+ *      Input, starting at the beginning of a row
+ *  @param len
+ *      Length of @p buf
+ *  @param base
+ *      Offset of the block
+ *  @param quotes
+ *      Quote mask of the block
+ *  @param inq
+ *      Quoted stretch mask of the block, which has the bits of opening quotes
+ *      set and those of closing quotes clear
+ *  @returns true if they all do
+ */
+static bool tomo_scan_quotes_ok(const char         *buf,
+                                size_t              len,
+                                size_t              base,
+                                unsigned long long  quotes,
+                                unsigned long long  inq)
+{
+    size_t pos, i;
+    unsigned idx;
+
+    while (quotes) {
+        idx = tomo_scan_ctz(quotes);
+        pos = base + idx;
+        if ((inq >> idx) & 1) {
+            for (i = pos; i && tomo_scan_space(buf[i - 1]); i--);
+            /* The start of the input is the start of a row */
+            if (i && !tomo_scan_sep(buf[i - 1]) && !(i == pos && buf[i - 1] == '"')) {
+                return false;
+            }
+        } else {
+            for (i = pos + 1; i < len && tomo_scan_space(buf[i]); i++);
+            /* Input that ends here either ends the field, or leaves its row to
+            be passed again */
+            if (i < len && !tomo_scan_sep(buf[i]) && !(i == pos + 1 && buf[i] == '"')) {
+                return false;
+            }
+        }
+        quotes &= quotes - 1;
+    }
+    return true;
+}
+
+
+/** @brief Copy a projected field into @p scan, trimming it and undoing its
+ *      quoting, and hand it to the field callback
+ *  @param scan
+ *      Scanner
+ *  @param col
+ *      Column of the field
+ *  @param src
+ *      Raw field
+ *  @param len
+ *      Length of @p src
+ */
+static void tomo_scan_emit(TOMO_SCANNER *scan,
+                           unsigned      col,
+                           const char   *src,
+                           size_t        len)
+{
+    const size_t cap = TOMO_SCAN_FIELDLEN - 1;
+    char *const dst = scan->field;
+    size_t i, n = 0;
+
+    while (len && tomo_scan_space(*src)) {
+        src++;
+        len--;
+    }
+    while (len && tomo_scan_space(src[len - 1])) {
+        len--;
+    }
+    if (len && *src == '"') {
+        src++;
+        len--;
+        if (len && src[len - 1] == '"') {
+            len--;
+        }
+        for (i = 0; i < len && n < cap; i++) {
+            dst[n++] = src[i];
+            if (src[i] == '"' && i + 1 < len && src[i + 1] == '"') {
+                i++;
+            }
+        }
+    } else {
+        n = (len < cap) ? len : cap;
+        memcpy(dst, src, n);
+    }
+    dst[n] = '\0';
+    scan->fieldcb(col, dst, n, scan->data);
+}
+
+
+/** @brief Hand a whole row to the callbacks
+ *  @param scan
+ *      Scanner
+ *  @param buf
+ *      Input the offsets are into
+ *  @param start
+ *      Offset of each projected field found in the row
+ *  @param end
+ *      End offset of each of them
+ *  @param n
+ *      Number of projected fields found, which is less than scan->ncols if
+ *      the row is short
+ */
+static void tomo_scan_row(TOMO_SCANNER *scan,
+                          const char   *buf,
+                          const size_t *start,
+                          const size_t *end,
+                          unsigned      n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        tomo_scan_emit(scan, scan->cols[i], buf + start[i], end[i] - start[i]);
+    }
+    scan->rowcb(scan->data);
+    scan->nrows++;
+}
+
+
+/** States of tomo_scan_lenient(), after libcsv's */
+enum tomo_scan_state {
+    TOMO_SCAN_ROW_NOT_BEGUN,
+    TOMO_SCAN_FIELD_NOT_BEGUN,
+    TOMO_SCAN_FIELD_BEGUN,
+    TOMO_SCAN_FIELD_MIGHT_HAVE_ENDED
+};
+
+
+/** A row being read by tomo_scan_lenient(). Its projected fields are held
+ *  until the row ends, as tomo_scan() only hands over whole rows
+ */
+struct tomo_scan_pending {
+    char field[TOMO_SCAN_MAXCOLS][TOMO_SCAN_FIELDLEN];
+    size_t len[TOMO_SCAN_MAXCOLS];
+    unsigned col;       /* Column being read */
+    unsigned next;      /* Projected fields read */
+    size_t n;           /* Length of the field so far, including any truncated */
+    size_t spaces;      /* Trailing spaces counted into n */
+    bool quoted;
+};
+
+
+/** @brief Check whether the column being read is projected */
+static bool tomo_scan_keep(const TOMO_SCANNER *scan, const struct tomo_scan_pending *r)
+{
+    return r->next < scan->ncols && r->col == scan->cols[r->next];
+}
+
+
+/** @brief Append @p c to the field being read, if it is projected */
+static void tomo_scan_put(const TOMO_SCANNER *scan, struct tomo_scan_pending *r, char c)
+{
+    if (tomo_scan_keep(scan, r) && r->n < TOMO_SCAN_FIELDLEN - 1) {
+        r->field[r->next][r->n] = c;
+    }
+    r->n++;
+}
+
+
+/** @brief End the field being read, trimming the spaces after an unquoted one */
+static void tomo_scan_endfield(const TOMO_SCANNER *scan, struct tomo_scan_pending *r)
+{
+    size_t n;
+
+    if (tomo_scan_keep(scan, r)) {
+        n = (r->quoted) ? r->n : r->n - r->spaces;
+        n = (n < TOMO_SCAN_FIELDLEN - 1) ? n : TOMO_SCAN_FIELDLEN - 1;
+        r->field[r->next][n] = '\0';
+        r->len[r->next++] = n;
+    }
+    r->col++;
+    r->n = r->spaces = 0;
+    r->quoted = false;
+}
+
+
+/** @brief Hand the row read to the callbacks, and start the next */
+static void tomo_scan_endrow(TOMO_SCANNER *scan, struct tomo_scan_pending *r)
+{
+    unsigned i;
+
+    for (i = 0; i < r->next; i++) {
+        scan->fieldcb(scan->cols[i], r->field[i], r->len[i], scan->data);
+    }
+    scan->rowcb(scan->data);
+    scan->nrows++;
+    r->col = r->next = 0;
+}
+
+
+/** @brief End the field being read at separator @p c, and its row too if
+ *      @p c breaks the line
+ *  @returns State to go on in
+ */
+static enum tomo_scan_state tomo_scan_sepfield(TOMO_SCANNER         *scan,
+                                               struct tomo_scan_pending *r,
+                                               char                  c)
+{
+    tomo_scan_endfield(scan, r);
+    if (c == ',') {
+        return TOMO_SCAN_FIELD_NOT_BEGUN;
+    }
+    tomo_scan_endrow(scan, r);
+    return TOMO_SCAN_ROW_NOT_BEGUN;
+}
+
+
+/** @brief Tokenize a byte at a time, for input with quotes the masks cannot
+ *      account for. Quotes are read as libcsv reads them outside of strict
+ *      mode: one only opens a quoted field at the start of the field, and is
+ *      otherwise taken literally, as is a closing quote followed by anything
+ *      but a separator. Arguments and result are as for tomo_scan()
+ */
+static size_t tomo_scan_lenient(TOMO_SCANNER *scan, const char *buf, size_t len, bool final)
+{
+    enum tomo_scan_state state = TOMO_SCAN_ROW_NOT_BEGUN;
+    struct tomo_scan_pending r;
+    size_t i, row = 0;
+    char c;
+
+    r.col = r.next = 0;
+    r.n = r.spaces = 0;
+    r.quoted = false;
+    for (i = 0; i < len; i++) {
+        c = buf[i];
+        switch (state) {
+        case TOMO_SCAN_ROW_NOT_BEGUN:
+            if (c == '\n' || c == '\r') {
+                break;
+            }
+            state = TOMO_SCAN_FIELD_NOT_BEGUN;
+            /* fall through */
+        case TOMO_SCAN_FIELD_NOT_BEGUN:
+            if (tomo_scan_space(c)) {
+                break;
+            }
+            if (c == '"') {
+                r.quoted = true;
+                state = TOMO_SCAN_FIELD_BEGUN;
+            } else if (tomo_scan_sep(c)) {
+                state = tomo_scan_sepfield(scan, &r, c);
+            } else {
+                tomo_scan_put(scan, &r, c);
+                state = TOMO_SCAN_FIELD_BEGUN;
+            }
+            break;
+        case TOMO_SCAN_FIELD_BEGUN:
+            if (c == '"') {
+                /* The closing quote is taken back off if the field ends */
+                tomo_scan_put(scan, &r, c);
+                r.spaces = 0;
+                if (r.quoted) {
+                    state = TOMO_SCAN_FIELD_MIGHT_HAVE_ENDED;
+                }
+            } else if (tomo_scan_sep(c) && !r.quoted) {
+                state = tomo_scan_sepfield(scan, &r, c);
+            } else {
+                tomo_scan_put(scan, &r, c);
+                r.spaces = (!r.quoted && tomo_scan_space(c)) ? r.spaces + 1 : 0;
+            }
+            break;
+        case TOMO_SCAN_FIELD_MIGHT_HAVE_ENDED:
+            if (tomo_scan_sep(c)) {
+                r.n -= r.spaces + 1;
+                state = tomo_scan_sepfield(scan, &r, c);
+            } else if (tomo_scan_space(c)) {
+                tomo_scan_put(scan, &r, c);
+                r.spaces++;
+            } else if (c == '"' && !r.spaces) {
+                /* Escaped quote, of which one was kept */
+                state = TOMO_SCAN_FIELD_BEGUN;
+            } else if (c == '"') {
+                tomo_scan_put(scan, &r, c);
+                r.spaces = 0;
+            } else {
+                tomo_scan_put(scan, &r, c);
+                r.spaces = 0;
+                state = TOMO_SCAN_FIELD_BEGUN;
+            }
+            break;
+        }
+        if (state == TOMO_SCAN_ROW_NOT_BEGUN) {
+            row = i + 1;
+        }
+    }
+    if (final && state != TOMO_SCAN_ROW_NOT_BEGUN) {
+        if (state == TOMO_SCAN_FIELD_MIGHT_HAVE_ENDED) {
+            r.n -= r.spaces + 1;
+        }
+        tomo_scan_endfield(scan, &r);
+        tomo_scan_endrow(scan, &r);
+        row = len;
+    }
+    scan->nbytes += row;
+    return row;
+}
+
+
+/** @brief Fall back to tomo_scan_lenient() for good, from @p row on. The rows
+ *      before it have been handed over already
+ */
+static size_t tomo_scan_fallback(TOMO_SCANNER *scan,
+                                 const char   *buf,
+                                 size_t        len,
+                                 size_t        row,
+                                 bool          final)
+{
+    scan->lenient = true;
+    scan->lenient_row = scan->nrows;
+    scan->nbytes += row;
+    return row + tomo_scan_lenient(scan, buf + row, len - row, final);
+}
+
+
+size_t tomo_scan(TOMO_SCANNER *scan, const char *buf, size_t len, bool final)
+{
+    size_t start[TOMO_SCAN_MAXCOLS], end[TOMO_SCAN_MAXCOLS];
+    unsigned long long inq, quoted = 0, all, ends, bits;
+    size_t base, pos, field = 0, row = 0;
+    unsigned col = 0, next = 0, idx;
+    char tail[TOMO_SCAN_BLOCK];
+    TOMO_SCANMASKS m;
+
+    if (scan->lenient) {
+        return tomo_scan_lenient(scan, buf, len, final);
+    }
+    for (base = 0; base < len; base += TOMO_SCAN_BLOCK) {
+        if (len - base >= TOMO_SCAN_BLOCK) {
+            tomo_scan_proc(buf + base, &m);
+        } else {
+            /* Nul padding classifies as nothing */
+            memset(tail, 0, sizeof tail);
+            memcpy(tail, buf + base, len - base);
+            tomo_scan_proc(tail, &m);
+        }
+        inq = tomo_scan_prefix_xor(m.quotes) ^ quoted;
+        if (m.quotes && !tomo_scan_quotes_ok(buf, len, base, m.quotes, inq)) {
+            return tomo_scan_fallback(scan, buf, len, row, final);
+        }
+        quoted = 0ULL - (inq >> 63);
+        all = (m.commas | m.newlines) & ~inq;
+        ends = m.newlines & ~inq;
+        /* Past the last projected column only the end of the row matters */
+        bits = (next < scan->ncols) ? all : ends;
+        while (bits) {
+            idx = tomo_scan_ctz(bits);
+            pos = base + idx;
+            if (next < scan->ncols && col == scan->cols[next]) {
+                start[next] = field;
+                end[next++] = pos;
+            }
+            if (buf[pos] == ',') {
+                col++;
+            } else {
+                if (pos > row) {
+                    tomo_scan_row(scan, buf, start, end, next);
+                }
+                col = next = 0;
+                row = pos + 1;
+            }
+            field = pos + 1;
+            bits = ((next < scan->ncols) ? all : ends) & (~1ULL << idx);
+        }
+    }
+    if (final && quoted) {
+        /* A quote left open at the end never closed its field */
+        return tomo_scan_fallback(scan, buf, len, row, final);
+    }
+    if (final && row < len) {
+        if (next < scan->ncols && col == scan->cols[next]) {
+            start[next] = field;
+            end[next++] = len;
+        }
+        tomo_scan_row(scan, buf, start, end, next);
+        row = len;
+    }
+    scan->nbytes += row;
+    return row;
+}
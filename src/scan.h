@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef TOMOSRV_SCAN_H
+#define TOMOSRV_SCAN_H
+
+#include "defines.h"
+#include <stddef.h>
+
+
+/** Most columns a scanner projects */
+#define TOMO_SCAN_MAXCOLS 4
+
+/** Longest field handed to a callback, including its nul terminator. Longer
+ *  fields are truncated
+ */
+#define TOMO_SCAN_FIELDLEN 512
+
+
+/** @brief Receives one projected field of a row
+ *  @param col
+ *      Column of the field
+ *  @param field
+ *      The field, unquoted, trimmed and nul-terminated, in scanner memory
+ *  @param len
+ *      Length of @p field
+ *  @param data
+ *      User data
+ */
+typedef void TOMO_SCAN_FIELDCB(unsigned col, const char *field, size_t len, void *data);
+
+
+/** @brief Receives the end of a row, after all of its projected fields
+ *  @param data
+ *      User data
+ */
+typedef void TOMO_SCAN_ROWCB(void *data);
+
+
+/** Column-projecting CSV tokenizer. Input is classified 64 bytes at a time
+ *  into bitmasks of quotes, commas and newlines (with AVX2 or SSE2 where the
+ *  processor has them), and the quoted stretches are masked out of the latter
+ *  two with a prefix XOR over the quotes, so that only the separators that
+ *  matter are ever visited. Fields of columns that are not projected are
+ *  skipped without being looked at, and once the last projected column of a
+ *  row is passed, so are the rest of its commas
+ *
+ *  Quoting is as RFC 4180 has it: a quote only opens a quoted field at its
+ *  start, and is doubled to escape it inside one. As libcsv does by default,
+ *  spaces and tabs around fields are trimmed, CR and LF both end rows, and
+ *  empty rows are skipped
+ *
+ *  Every quote is checked against that, since one inside an unquoted field or
+ *  followed by more text after closing its field would throw the masks out of
+ *  step with the rows. From the row holding the first such quote on, the
+ *  scanner reads a byte at a time instead, taking stray quotes as literal
+ *  characters as libcsv does outside of strict mode
+ *
+ *  Fill in cols, ncols, the callbacks and data, and zero the rest
+ */
+typedef struct tomo_scanner {
+    unsigned cols[TOMO_SCAN_MAXCOLS];   /* Projected columns, ascending */
+    unsigned ncols;
+
+    TOMO_SCAN_FIELDCB *fieldcb;
+    TOMO_SCAN_ROWCB *rowcb;
+    void *data;
+
+    /* Statistics */
+    size_t nrows;       /* Rows handed to rowcb */
+    size_t nbytes;      /* Bytes consumed */
+    bool lenient;       /* Set once a stray quote turned scanning byte-at-a-time */
+    size_t lenient_row; /* Rows handed to rowcb before that */
+
+    char field[TOMO_SCAN_FIELDLEN];
+} TOMO_SCANNER;
+
+
+/** @brief Pick the fastest classifier this processor supports. Call this once
+ *      before scanning
+ */
+void tomo_scan_init(void);
+
+
+/** @brief Get a description of the classifier in use */
+const wchar_t *tomo_scan_name(void);
+
+
+/** @brief Tokenize the rows in @p buf. A row's fields are only handed to the
+ *      callbacks once its end is found
+ *  @param scan
+ *      Scanner
+ *  @param buf
+ *      CSV data, starting at the beginning of a row
+ *  @param len
+ *      Length of @p buf
+ *  @param final
+ *      If true, @p buf runs to the end of the input, and a last row missing
+ *      its newline is taken as whole
+ *  @returns The number of bytes consumed, which is @p len when @p final is
+ *      set. Otherwise whatever follows the last newline is left, and should be
+ *      passed again at the front of the next call
+ */
+size_t tomo_scan(TOMO_SCANNER *scan, const char *buf, size_t len, bool final);
+
+
+#endif /* TOMOSRV_SCAN_H */
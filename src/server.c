@@ -1,300 +1,775 @@
-#include <stdio.h>
-#include "server.h"
-#include "endpoint.h"
-#include "error.h"
-#include "log.h"
-
-
-/** @brief Load the MRN table from disk */
-static int tomo_server_load_table(TOMO_SERVER *serv, const wchar_t *path)
-{
-    if (tomo_csv_load(&serv->table, path)) {
-        return 1;
-    }
-    return 0;
-}
-
-
-/** @brief Initialize Winsock2
- *  @param serv
- *      Server state buffer
- *  @returns Nonzero on error
- */
-static int tomo_server_wsainit(TOMO_SERVER *serv)
-{
-    const WORD ver = MAKEWORD(2, 2);
-    int res;
-
-    res = WSAStartup(ver, &serv->wsadata);
-    if (res) {
-        tomo_error_raise(TOMO_ERROR_SOCK, &res, L"Cannot initialize Winsock2");
-    }
-    return res;
-}
-
-
-/** @brief Look up @p name and replace the string with the relevant MRN
- *  @param serv
- *      Server state
- *  @param name
- *      Name string, make sure this is nul-terminated
- *  @param len
- *      Length of the @p name buffer (NOT THE STRING!)
- */
-static void tomo_server_name_lookup(TOMO_SERVER *serv, char *name, size_t len)
-/** This function will have to be changed depending on the lookup methodology
- *  Access to the SQL server will obsolesce any other method
- */
-{
-    static const char *def = "NOT FOUND", *delim[2] = { "", "\n" };
-    const TOMO_MRNPAIR *pair;
-    unsigned i = 0;
-
-    tomo_logf(TOMO_LOG_DEBUG, L"Looking up %S", name);
-    pair = tomo_mrntable_lookup(&serv->table, name);
-    if (!pair) {
-        snprintf(name, len, def);
-    } else if (tomo_mrnlist_sprint(name, len, pair->val)) {
-        tomo_log_error(TOMO_LOG_WARN);
-        tomo_error_reset();
-    }
-}
-
-
-/** @brief Callback invoked on a client connection endpoint when data is ready
- *      to be read
- *  @param conn
- *      Connected endpoint
- *  @param arg
- *      Server state
- *  @returns A multiplexer status code
- */
-static int tomo_server_connection_callback(TOMO_ENDPOINT *conn, void *arg)
-{
-    TOMO_SERVER *const serv = arg;
-    char buf[512];
-    size_t len = BUFLEN(buf) - 1;   /* Sub 1 to facilitate adding a nul term */
-
-    if (tomo_endpoint_recv(conn, buf, &len)) {
-        return TOMO_ENDPT_ERROR;
-    } else if (!len) {
-        return TOMO_ENDPT_CLOSED;
-    }
-    buf[len] = '\0';
-    tomo_server_name_lookup(serv, buf, BUFLEN(buf));
-    tomo_logf(TOMO_LOG_DEBUG, L"Replying with %S", buf);
-    if (tomo_endpoint_send(conn, buf, strlen(buf)) < 0) {
-        return TOMO_ENDPT_ERROR;
-    }
-    return 0;
-}
-
-
-/** @brief Callback invoked on a listening socket that is ready for IO
- *  @param lisnr
- *      The listening endpoint
- *  @param arg
- *      A pointer to the server state
- *  @returns One of the multiplexer status codes
- */
-static int tomo_server_accept_callback(TOMO_ENDPOINT *lisnr, void *arg)
-{
-    TOMO_SERVER *const serv = arg;
-    TOMO_ENDPOINT endp = {
-        .proc = tomo_server_connection_callback,
-        .data = arg
-    };
-    SHORT evt = POLLIN;
-    wchar_t ip[65];
-    int res = 0;
-
-    if (tomo_endpoint_accept(lisnr, &endp)) {
-        res = TOMO_ENDPT_ERROR;
-    } else if (tomo_multiplexer_add(&serv->muxer, 1, &endp, &evt)) {
-        tomo_endpoint_close(&endp);
-        res = TOMO_ENDPT_ERROR;
-    }
-    if (!res) {
-        tomo_sockaddr_str(ip, BUFLEN(ip), &endp.addr);
-        tomo_logf(TOMO_LOG_INFO, L"Opened connection from %s", ip);
-    }
-    return res;
-}
-
-
-/** @brief Prepare the listener
- *  @param serv
- *      Server state buffer
- *  @param port
- *      Port to begin listening on
- *  @returns Nonzero on error
- */
-static int tomo_server_open_listener(TOMO_SERVER *serv, u_short port)
-{
-    TOMO_ENDPOINT endp = {
-        .proc = tomo_server_accept_callback,
-        .data = serv
-    };
-    SHORT evt = POLLIN;
-    int res;
-
-    res = tomo_endpoint_open(&endp, AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-    if (res) {
-        return 1;
-    }
-    if (tomo_endpoint_dual(&endp)) {
-        tomo_log_error(TOMO_LOG_WARN);
-        tomo_error_reset();
-    }
-    res = tomo_endpoint_bind(&endp, port)
-       || tomo_endpoint_listen(&endp, SOMAXCONN);
-    if (!res) {
-        res = tomo_multiplexer_add(&serv->muxer, 1, &endp, &evt);
-    }
-    return res;
-}
-
-
-/** @brief Initializes the handle for the current thread
- *  @param serv
- *      Server state
- *  @returns Nonzero on error
- */
-static int tomo_server_init_current(TOMO_SERVER *serv)
-{
-    static const wchar_t *failmsg = L"Cannot get main thread handle";
-
-    serv->monid = GetCurrentThreadId(); /* afaik this function can't fail */
-    serv->monitor = OpenThread(THREAD_GET_CONTEXT, FALSE, serv->monid);
-    if (!serv->monitor) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-    }
-    return serv->monitor == NULL;
-}
-
-
-/** @brief Initialize the semaphore used to block the monitor thread
- *  @param serv
- *      Server state
- *  @returns Nonzero on error
- */
-static int tomo_server_init_event(TOMO_SERVER *serv)
-{
-    static const wchar_t *failmsg = L"Cannot create APC event";
-
-    serv->apc_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
-    if (!serv->apc_evt) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-    }
-    return serv->apc_evt == NULL;
-}
-
-
-/** @brief Entry point for the polling thread
- *  @param arg
- *      Server state
- *  @returns Who cares
- */
-static DWORD WINAPI tomo_server_poller(void *arg)
-{
-    TOMO_SERVER *serv = arg;
-    int res;
-
-    do {
-        res = tomo_multiplexer_poll(&serv->muxer, -1);
-    } while (!res);
-    if (res) {
-        tomo_log_error(TOMO_LOG_ERROR);
-    }
-    return res;
-}
-
-
-/** @brief Start the polling thread
- *  @param serv
- *      Server state
- *  @returns Nonzero on error
- */
-static int tomo_server_start_poller(TOMO_SERVER *serv)
-{
-    static const wchar_t *failmsg = L"Cannot create socket poller thread";
-
-    serv->poller = CreateThread(NULL,
-                                0,
-                                tomo_server_poller,
-                                serv,
-                                CREATE_SUSPENDED,
-                                &serv->pollid);
-    if (!serv->poller) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
-    }
-    return serv->poller == NULL;
-}
-
-
-/** @brief Create the poller thread and initialize thread handles/IDs
- *  @param serv
- *      Server state
- *  @returns Nonzero on error
- */
-static int tomo_server_init_threads(TOMO_SERVER *serv)
-{
-    return tomo_server_init_current(serv)
-        || tomo_server_init_event(serv)
-        || tomo_server_start_poller(serv);
-}
-
-
-int tomo_server_open(TOMO_SERVER *serv, u_short port, const wchar_t *path)
-{
-    int res;
-
-    res = tomo_server_load_table(serv, path)
-       || tomo_server_wsainit(serv)
-       || tomo_server_open_listener(serv, port);
-    if (!res) {
-        tomo_logf(TOMO_LOG_INFO, L"Opened listener on port %u", port);
-        res = tomo_server_init_threads(serv);
-    }
-    return res;
-}
-
-
-int tomo_server_run(TOMO_SERVER *serv)
-{
-    DWORD res;
-
-    res = ResumeThread(serv->poller);
-    if (res == (DWORD)-1) {
-        tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot resume poller");
-        return 1;
-    }
-    do {
-        res = WaitForSingleObjectEx(serv->apc_evt, INFINITE, TRUE);
-        if (res == WAIT_FAILED) {
-            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Event blocking failed");
-            serv->shouldquit = true;
-        }
-    } while (!serv->shouldquit);
-    return res == WAIT_FAILED;
-}
-
-
-void tomo_server_shutdown(TOMO_SERVER *serv)
-{
-    if (serv) {
-        serv->shouldquit = true;
-        SetEvent(serv->apc_evt);
-    }
-}
-
-
-void tomo_server_close(TOMO_SERVER *serv)
-{
-    CloseHandle(serv->apc_evt);
-    TerminateThread(serv->poller, 0);
-    CloseHandle(serv->poller);
-    tomo_multiplexer_clear(&serv->muxer);
-    tomo_mrntable_free(&serv->table);
-    WSACleanup();
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include "server.h"
+#include "endpoint.h"
+#include "connection.h"
+#include "structures/hash.h"
+#include "error.h"
+#include "log.h"
+
+/** Interval between reactor statistics reports in the log */
+#define TOMO_SERVER_REPORT_MS 60000
+
+/** Longest query datagram accepted. Anything longer fails to receive */
+#define TOMO_SERVER_DGRAM_MAX 512
+
+/** Datagrams answered per wakeup before the reactor gets back to its other
+ *  sockets. Whatever is left over wakes the next poll immediately
+ */
+#define TOMO_SERVER_DGRAM_BATCH 64
+
+
+/** @brief Load the MRN table from disk, and freeze it if so configured. A table
+ *  that fails to freeze is still usable, so that is only a warning
+ */
+static int tomo_server_load_table(TOMO_SERVER *serv, const TOMO_SERVCONF *conf)
+{
+    ULONGLONG start;
+
+    if (tomo_hash_init()
+     || tomo_csv_load(&serv->table, conf->path, conf->name_column, conf->mrn_column)) {
+        return 1;
+    }
+    if (conf->frozen) {
+        start = GetTickCount64();
+        if (tomo_mrntable_freeze(&serv->table)) {
+            tomo_log_error(TOMO_LOG_WARN);
+            tomo_error_reset();
+        } else {
+            tomo_logf(TOMO_LOG_INFO, L"Froze MRN table in %llu ms", GetTickCount64() - start);
+        }
+    }
+    if (tomo_log_enabled(TOMO_LOG_DEBUG)) {
+        tomo_mrntable_log_probes(&serv->table, TOMO_LOG_DEBUG);
+    }
+    return 0;
+}
+
+
+/** @brief Initialize Winsock2
+ *  @param serv
+ *      Server state buffer
+ *  @returns Nonzero on error
+ */
+static int tomo_server_wsainit(TOMO_SERVER *serv)
+{
+    const WORD ver = MAKEWORD(2, 2);
+    int res;
+
+    res = WSAStartup(ver, &serv->wsadata);
+    if (res) {
+        tomo_error_raise(TOMO_ERROR_SOCK, &res, L"Cannot initialize Winsock2");
+    }
+    return res;
+}
+
+
+/** @brief Get the reply for a lookup result. Every reply is one or more lines
+ *      terminated by an empty line, so that clients can tell where each of
+ *      their pipelined answers ends
+ *  @param pair
+ *      Table entry found, or NULL
+ *  @param len
+ *      The length of the reply is written here
+ *  @returns The reply. It is rendered ahead of time in table memory (or is a
+ *      constant), so it must not be modified
+ */
+static const char *tomo_server_pair_reply(const TOMO_MRNPAIR *pair,
+                                          size_t             *len)
+{
+    static const char def[] = "NOT FOUND\n\n";
+
+    if (pair) {
+        return tomo_mrnpair_reply(pair, len);
+    }
+    *len = BUFLEN(def) - 1;
+    return def;
+}
+
+
+/** @brief Look up @p name and get its reply
+ *  @param serv
+ *      Server state
+ *  @param name
+ *      Name string, make sure this is nul-terminated
+ *  @param len
+ *      The length of the reply is written here
+ *  @returns The reply, see tomo_server_pair_reply()
+ */
+static const char *tomo_server_name_reply(TOMO_SERVER *serv,
+                                          const char  *name,
+                                          size_t      *len)
+/** This function will have to be changed depending on the lookup methodology
+ *  Access to the SQL server will obsolesce any other method
+ */
+{
+    tomo_logf(TOMO_LOG_DEBUG, L"Looking up %S", name);
+    return tomo_server_pair_reply(tomo_mrntable_lookup(&serv->table, name),
+                                  len);
+}
+
+
+/** @brief Callback invoked on the UDP socket when datagrams are waiting. Each
+ *      datagram holds one query (a trailing line ending is optional) and gets
+ *      one datagram back with the same reply a stream client would see
+ *  @param endp
+ *      The shared UDP endpoint
+ *  @param arg
+ *      The reactor polling this copy of it
+ *  @returns Zero. The socket is shared by every reactor, so errors are only
+ *      logged
+ */
+static int tomo_server_datagram_callback(TOMO_ENDPOINT *endp, void *arg)
+{
+    TOMO_REACTOR *const rctr = arg;
+    TOMO_SOCKADDR46 from;
+    char query[TOMO_SERVER_DGRAM_MAX + 1];
+    const char *reply;
+    size_t len;
+    LONG count;
+    int res = 0;
+
+    for (count = 0; count < TOMO_SERVER_DGRAM_BATCH; count++) {
+        len = TOMO_SERVER_DGRAM_MAX;
+        res = tomo_endpoint_recvfrom(endp, query, &len, &from);
+        if (res) {
+            break;
+        }
+        while (len && (query[len - 1] == '\n' || query[len - 1] == '\r')) {
+            len--;
+        }
+        query[len] = '\0';
+        reply = tomo_server_name_reply(rctr->serv, query, &len);
+        if (tomo_endpoint_sendto(endp, reply, len, &from)) {
+            tomo_log_error(TOMO_LOG_WARN);
+            tomo_error_reset();
+        }
+    }
+    if (res < 0) {
+        tomo_log_error(TOMO_LOG_WARN);
+        tomo_error_reset();
+    }
+    if (count) {
+        InterlockedExchangeAdd(&rctr->queries, count);
+    }
+    return 0;
+}
+
+
+/** @brief Read from a client and answer every complete query in the read
+ *      buffer, in order. Pipelined queries are looked up together in batches
+ *  @param conn
+ *      Connection state
+ *  @param endp
+ *      Connected endpoint
+ *  @returns A multiplexer status code
+ */
+static int tomo_server_connection_read(TOMO_CONNECTION *conn,
+                                       TOMO_ENDPOINT   *endp)
+{
+    TOMO_REACTOR *const rctr = conn->data;
+    const char *names[TOMO_MRNTABLE_BATCH];
+    const TOMO_MRNPAIR *pairs[TOMO_MRNTABLE_BATCH];
+    const char *reply;
+    size_t i, n, len;
+    LONG count = 0;
+    int res;
+
+    res = tomo_connection_recv(conn, endp);
+    if (res) {
+        return res;
+    }
+    for (;;) {
+        /* The names stay valid in the read buffer until the next receive */
+        for (n = 0; n < TOMO_MRNTABLE_BATCH; n++) {
+            names[n] = tomo_connection_next(conn);
+            if (!names[n]) {
+                break;
+            }
+            tomo_logf(TOMO_LOG_DEBUG, L"Looking up %S", names[n]);
+        }
+        if (!n) {
+            break;
+        }
+        tomo_mrntable_lookup_many(&rctr->serv->table, names, n, pairs);
+        for (i = 0; i < n; i++) {
+            reply = tomo_server_pair_reply(pairs[i], &len);
+            /* Only the last reply may skip the queue, the rest are coalesced
+            and go out with the flush that follows */
+            res = (i + 1 < n) ? tomo_connection_queue(conn, reply, len)
+                              : tomo_connection_reply(conn, endp, reply, len);
+            if (res) {
+                return TOMO_ENDPT_ERROR;
+            }
+        }
+        count += (LONG)n;
+    }
+    if (count) {
+        InterlockedExchangeAdd(&rctr->queries, count);
+    }
+    return 0;
+}
+
+
+/** @brief Push back the deadline of @p conn. A client in the middle of a query
+ *      line gets the read timeout, anyone else the idle timeout
+ *  @param rctr
+ *      Reactor that owns @p conn
+ *  @param conn
+ *      Connection state
+ */
+static void tomo_server_connection_touch(TOMO_REACTOR    *rctr,
+                                         TOMO_CONNECTION *conn)
+{
+    const DWORD ms = (conn->rlen > conn->rpos) ? rctr->serv->read_ms
+                                               : rctr->serv->idle_ms;
+
+    if (ms) {
+        tomo_wheel_insert(&rctr->wheel, &conn->timer, GetTickCount64() + ms);
+    } else {
+        tomo_wheel_cancel(&rctr->wheel, &conn->timer);
+    }
+}
+
+
+/** @brief Timer callback for a connection whose deadline passed
+ *  @param tmr
+ *      Connection timer
+ *  @param arg
+ *      Connection state
+ */
+static void tomo_server_connection_expire(TOMO_TIMER *tmr, void *arg)
+{
+    TOMO_CONNECTION *const conn = arg;
+    TOMO_REACTOR *const rctr = conn->data;
+
+    (void)tmr;
+    tomo_logf(TOMO_LOG_INFO, L"Reactor %u timed out a connection", rctr->idx);
+    tomo_multiplexer_close(&rctr->muxer, conn->hndl);
+}
+
+
+/** @brief Callback invoked on a client connection endpoint when it is ready
+ *      for IO. Queries are answered and the replies from one wakeup go out in
+ *      a single send. Whatever the client is not ready to take stays queued,
+ *      and the connection waits for POLLOUT instead of blocking the reactor
+ *  @param endp
+ *      Connected endpoint
+ *  @param arg
+ *      Connection state
+ *  @returns A multiplexer status code
+ */
+static int tomo_server_connection_callback(TOMO_ENDPOINT *endp, void *arg)
+{
+    TOMO_CONNECTION *const conn = arg;
+    int res;
+
+    if (endp->revents & (POLLIN | POLLERR | POLLHUP)) {
+        res = tomo_server_connection_read(conn, endp);
+        if (res == TOMO_ENDPT_CLOSED) {
+            /* Best effort for clients that shut down their sending side */
+            tomo_connection_flush(conn, endp);
+            tomo_error_reset();
+        }
+        if (res) {
+            return res;
+        }
+    }
+    if (tomo_connection_flush(conn, endp)) {
+        return TOMO_ENDPT_ERROR;
+    }
+    endp->events = tomo_connection_events(conn);
+    tomo_server_connection_touch(conn->data, conn);
+    return 0;
+}
+
+
+/** @brief Endpoint destructor for client connections
+ *  @param endp
+ *      Connected endpoint, already closed
+ *  @param arg
+ *      Connection state
+ */
+static void tomo_server_connection_dtor(TOMO_ENDPOINT *endp, void *arg)
+{
+    TOMO_CONNECTION *const conn = arg;
+    TOMO_REACTOR *const rctr = conn->data;
+
+    (void)endp;
+    tomo_wheel_cancel(&rctr->wheel, &conn->timer);
+    InterlockedDecrement(&rctr->conns);
+    tomo_slab_release(&rctr->connslab, tomo_slab_handle(conn));
+}
+
+
+/** @brief Accept one pending connection from @p lisnr into @p rctr
+ *  @param rctr
+ *      Reactor that will own the connection
+ *  @param lisnr
+ *      The listening endpoint
+ *  @returns Zero on success, positive if the backlog is empty, or negative on
+ *      error
+ */
+static int tomo_server_accept_one(TOMO_REACTOR *rctr, const TOMO_ENDPOINT *lisnr)
+{
+    TOMO_ENDPOINT endp = {
+        .events = POLLIN,
+        .proc = tomo_server_connection_callback
+    };
+    TOMO_CONNECTION *conn;
+    TOMO_HANDLE hndl;
+    wchar_t ip[65];
+    int res;
+
+    res = tomo_endpoint_accept(lisnr, &endp);
+    if (res) {
+        return res;
+    }
+    conn = tomo_slab_alloc(&rctr->connslab, &hndl);
+    if (conn) {
+        tomo_connection_init(conn, rctr);
+        conn->timer.proc = tomo_server_connection_expire;
+        conn->timer.data = conn;
+        endp.data = conn;
+        endp.dtor = tomo_server_connection_dtor;
+        InterlockedIncrement(&rctr->conns);
+    }
+    /* Nagle does not apply to AF_UNIX, which rejects TCP options */
+    res = !conn
+       || tomo_endpoint_nonblock(&endp, true)
+       || (rctr->serv->nodelay
+           && lisnr->addr.gen.sa_family != AF_UNIX
+           && tomo_endpoint_nodelay(&endp, true))
+       || tomo_multiplexer_add(&rctr->muxer, 1, &endp, &conn->hndl);
+    if (res) {
+        tomo_endpoint_close(&endp);
+        return -1;
+    }
+    tomo_server_connection_touch(rctr, conn);
+    InterlockedIncrement(&rctr->accepts);
+    if (tomo_log_enabled(TOMO_LOG_DEBUG)) {
+        tomo_sockaddr_str(ip, BUFLEN(ip), &endp.addr);
+        tomo_logf(TOMO_LOG_DEBUG, L"Reactor %u opened connection from %s", rctr->idx, ip);
+    }
+    return 0;
+}
+
+
+/** @brief Callback invoked on a listening socket that is ready for IO. The
+ *      whole backlog is drained in one wakeup, and whatever another reactor
+ *      grabs first is simply not seen here
+ *  @param lisnr
+ *      The listening endpoint
+ *  @param arg
+ *      The reactor polling this copy of the listener
+ *  @returns One of the multiplexer status codes
+ */
+static int tomo_server_accept_callback(TOMO_ENDPOINT *lisnr, void *arg)
+{
+    TOMO_REACTOR *const rctr = arg;
+    int res;
+
+    while (!(res = tomo_server_accept_one(rctr, lisnr)))
+        ;
+    if (res < 0) {
+        /* The listener is shared by every reactor, so an error returned from
+        here would close it out from under all of them. Anything left in the
+        backlog wakes the poll again */
+        tomo_log_error(TOMO_LOG_WARN);
+        tomo_error_reset();
+    }
+    return 0;
+}
+
+
+/** @brief Prepare the listener. It is shared by all reactors, so it is put in
+ *      non-blocking mode to keep the losers of an accept race from stalling
+ *  @param serv
+ *      Server state buffer
+ *  @param conf
+ *      Server configuration
+ *  @returns Nonzero on error
+ */
+static int tomo_server_open_listener(TOMO_SERVER         *serv,
+                                     const TOMO_SERVCONF *conf)
+{
+    const int backlog = (conf->backlog) ? SOMAXCONN_HINT(conf->backlog) : SOMAXCONN;
+    TOMO_ENDPOINT *const endp = &serv->listener;
+    int res;
+
+    endp->events = POLLIN;
+    endp->proc = tomo_server_accept_callback;
+    res = tomo_endpoint_open(endp, AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    if (res) {
+        return 1;
+    }
+    if (tomo_endpoint_dual(endp)) {
+        tomo_log_error(TOMO_LOG_WARN);
+        tomo_error_reset();
+    }
+    return tomo_endpoint_bind(endp, conf->port)
+        || tomo_endpoint_listen(endp, backlog)
+        || tomo_endpoint_nonblock(endp, true);
+}
+
+
+/** @brief Open the AF_UNIX listener for clients on the same host, which lets
+ *      them skip the TCP stack. It shares the accept path with the TCP one
+ *  @param serv
+ *      Server state buffer
+ *  @param conf
+ *      Server configuration
+ *  @returns Nonzero on error
+ */
+static int tomo_server_open_local(TOMO_SERVER         *serv,
+                                  const TOMO_SERVCONF *conf)
+{
+    const int backlog = (conf->backlog) ? SOMAXCONN_HINT(conf->backlog) : SOMAXCONN;
+    TOMO_ENDPOINT *const endp = &serv->local;
+    int res;
+
+    endp->events = POLLIN;
+    endp->proc = tomo_server_accept_callback;
+    res = tomo_endpoint_open(endp, AF_UNIX, SOCK_STREAM, 0);
+    if (res) {
+        return 1;
+    }
+    serv->localpath = conf->local;
+    return tomo_endpoint_bind_path(endp, conf->local)
+        || tomo_endpoint_listen(endp, backlog)
+        || tomo_endpoint_nonblock(endp, true);
+}
+
+
+/** @brief Open the UDP socket for single-datagram queries. Like the listener,
+ *      it is shared by all reactors and put in non-blocking mode
+ *  @param serv
+ *      Server state buffer
+ *  @param port
+ *      Port to bind
+ *  @returns Nonzero on error
+ */
+static int tomo_server_open_udp(TOMO_SERVER *serv, u_short port)
+{
+    TOMO_ENDPOINT *const endp = &serv->udp;
+    int res;
+
+    endp->events = POLLIN;
+    endp->proc = tomo_server_datagram_callback;
+    res = tomo_endpoint_open(endp, AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (res) {
+        return 1;
+    }
+    if (tomo_endpoint_dual(endp)) {
+        tomo_log_error(TOMO_LOG_WARN);
+        tomo_error_reset();
+    }
+    return tomo_endpoint_bind(endp, port)
+        || tomo_endpoint_nonblock(endp, true);
+}
+
+
+/** @brief Initializes the handle for the current thread
+ *  @param serv
+ *      Server state
+ *  @returns Nonzero on error
+ */
+static int tomo_server_init_current(TOMO_SERVER *serv)
+{
+    static const wchar_t *failmsg = L"Cannot get main thread handle";
+
+    serv->monid = GetCurrentThreadId(); /* afaik this function can't fail */
+    serv->monitor = OpenThread(THREAD_GET_CONTEXT, FALSE, serv->monid);
+    if (!serv->monitor) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+    }
+    return serv->monitor == NULL;
+}
+
+
+/** @brief Initialize the semaphore used to block the monitor thread
+ *  @param serv
+ *      Server state
+ *  @returns Nonzero on error
+ */
+static int tomo_server_init_event(TOMO_SERVER *serv)
+{
+    static const wchar_t *failmsg = L"Cannot create APC event";
+
+    serv->apc_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!serv->apc_evt) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+    }
+    return serv->apc_evt == NULL;
+}
+
+
+/** @brief Entry point for a polling thread. Expired connections are closed
+ *  before each poll, and the poll only sleeps until the next deadline
+ *  @param arg
+ *      Reactor
+ *  @returns Who cares
+ */
+static DWORD WINAPI tomo_server_poller(void *arg)
+{
+    TOMO_REACTOR *rctr = arg;
+    int res;
+
+    do {
+        tomo_wheel_advance(&rctr->wheel, GetTickCount64());
+        res = tomo_multiplexer_poll(&rctr->muxer, tomo_wheel_timeout(&rctr->wheel));
+    } while (!res);
+    if (res) {
+        tomo_log_error(TOMO_LOG_ERROR);
+    }
+    return res;
+}
+
+
+/** @brief Add a copy of the shared socket @p shared to the multiplexer of
+ *      @p rctr, with @p rctr as its callback argument. Nops if @p shared was
+ *      never opened
+ *  @param rctr
+ *      Reactor
+ *  @param shared
+ *      Socket shared between reactors
+ *  @param hndl
+ *      The copy's handle is written here
+ *  @returns Nonzero on error
+ */
+static int tomo_server_share(TOMO_REACTOR        *rctr,
+                             const TOMO_ENDPOINT *shared,
+                             TOMO_HANDLE         *hndl)
+{
+    TOMO_ENDPOINT endp = *shared;
+
+    if (endp.sock == INVALID_SOCKET) {
+        return 0;
+    }
+    endp.data = rctr;
+    return tomo_multiplexer_add(&rctr->muxer, 1, &endp, hndl);
+}
+
+
+/** @brief Give @p rctr its copies of the shared sockets and create its polling
+ *      thread
+ *  @param serv
+ *      Server state
+ *  @param rctr
+ *      Reactor
+ *  @returns Nonzero on error
+ */
+static int tomo_server_start_poller(TOMO_SERVER *serv, TOMO_REACTOR *rctr)
+{
+    static const wchar_t *failmsg = L"Cannot create socket poller thread";
+
+    tomo_slab_init(&rctr->connslab, sizeof (TOMO_CONNECTION));
+    tomo_wheel_init(&rctr->wheel, GetTickCount64());
+    if (tomo_server_share(rctr, &serv->listener, &rctr->lisnr)
+     || tomo_server_share(rctr, &serv->udp, &rctr->udpsock)
+     || tomo_server_share(rctr, &serv->local, &rctr->local)) {
+        return 1;
+    }
+    rctr->poller = CreateThread(NULL,
+                                0,
+                                tomo_server_poller,
+                                rctr,
+                                CREATE_SUSPENDED,
+                                &rctr->pollid);
+    if (!rctr->poller) {
+        tomo_error_raise(TOMO_ERROR_WIN32, NULL, failmsg);
+    }
+    return rctr->poller == NULL;
+}
+
+
+/** @brief Allocate the reactors and start their (suspended) polling threads
+ *  @param serv
+ *      Server state
+ *  @param count
+ *      Number of reactors. If zero, one is created per logical processor
+ *  @returns Nonzero on error
+ */
+static int tomo_server_init_reactors(TOMO_SERVER *serv, unsigned count)
+{
+    static const wchar_t *failmsg = L"Cannot allocate reactors";
+    SYSTEM_INFO info;
+    unsigned i;
+
+    if (!count) {
+        GetSystemInfo(&info);
+        count = info.dwNumberOfProcessors;
+    }
+    serv->reactors = calloc(count, sizeof *serv->reactors);
+    if (!serv->reactors) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        return 1;
+    }
+    serv->nreactors = count;
+    for (i = 0; i < count; i++) {
+        serv->reactors[i].serv = serv;
+        serv->reactors[i].idx = i;
+        if (tomo_server_start_poller(serv, &serv->reactors[i])) {
+            return 1;
+        }
+    }
+    tomo_logf(TOMO_LOG_INFO, L"Started %u reactor thread(s)", count);
+    return 0;
+}
+
+
+/** @brief Create the poller threads and initialize thread handles/IDs
+ *  @param serv
+ *      Server state
+ *  @param nreactors
+ *      Number of reactors requested
+ *  @returns Nonzero on error
+ */
+static int tomo_server_init_threads(TOMO_SERVER *serv, unsigned nreactors)
+{
+    return tomo_server_init_current(serv)
+        || tomo_server_init_event(serv)
+        || tomo_server_init_reactors(serv, nreactors);
+}
+
+
+int tomo_server_open(TOMO_SERVER *serv, const TOMO_SERVCONF *conf)
+{
+    int res;
+
+    serv->udp.sock = INVALID_SOCKET;
+    serv->local.sock = INVALID_SOCKET;
+    res = tomo_server_load_table(serv, conf)
+       || tomo_server_wsainit(serv)
+       || tomo_server_open_listener(serv, conf)
+       || (conf->udp_port && tomo_server_open_udp(serv, conf->udp_port))
+       || (conf->local && tomo_server_open_local(serv, conf));
+    serv->idle_ms = conf->idle_timeout * 1000;
+    serv->read_ms = conf->read_timeout * 1000;
+    serv->nodelay = conf->nodelay;
+    if (!res) {
+        tomo_logf(TOMO_LOG_INFO, L"Opened listener on port %u", conf->port);
+        if (conf->udp_port) {
+            tomo_logf(TOMO_LOG_INFO, L"Answering datagrams on port %u", conf->udp_port);
+        }
+        if (conf->local) {
+            tomo_logf(TOMO_LOG_INFO, L"Opened local listener at %s", conf->local);
+        }
+        res = tomo_server_init_threads(serv, conf->nreactors);
+    }
+    return res;
+}
+
+
+/** @brief Log the connection count, accept rate and query rate of every
+ *      reactor, and reset the rate counters
+ *  @param serv
+ *      Server state
+ *  @param elapsed
+ *      Milliseconds since the previous report
+ */
+static void tomo_server_report(TOMO_SERVER *serv, ULONGLONG elapsed)
+{
+    TOMO_REACTOR *rctr;
+    double aps, qps;
+    LONG accepts, queries;
+    unsigned i;
+
+    for (i = 0; i < serv->nreactors; i++) {
+        rctr = &serv->reactors[i];
+        accepts = InterlockedExchange(&rctr->accepts, 0);
+        queries = InterlockedExchange(&rctr->queries, 0);
+        aps = (elapsed) ? 1000.0 * accepts / elapsed : 0.0;
+        qps = (elapsed) ? 1000.0 * queries / elapsed : 0.0;
+        tomo_logf(TOMO_LOG_INFO, L"Reactor %u: %ld connections, %.1f accepts/sec, %.1f queries/sec",
+                  i, rctr->conns, aps, qps);
+    }
+}
+
+
+int tomo_server_run(TOMO_SERVER *serv)
+{
+    ULONGLONG last, now;
+    DWORD res;
+    unsigned i;
+
+    for (i = 0; i < serv->nreactors; i++) {
+        res = ResumeThread(serv->reactors[i].poller);
+        if (res == (DWORD)-1) {
+            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Cannot resume poller %u", i);
+            return 1;
+        }
+    }
+    last = GetTickCount64();
+    do {
+        res = WaitForSingleObjectEx(serv->apc_evt, TOMO_SERVER_REPORT_MS, TRUE);
+        if (res == WAIT_FAILED) {
+            tomo_error_raise(TOMO_ERROR_WIN32, NULL, L"Event blocking failed");
+            serv->shouldquit = true;
+        } else if (res == WAIT_TIMEOUT) {
+            now = GetTickCount64();
+            tomo_server_report(serv, now - last);
+            last = now;
+        }
+    } while (!serv->shouldquit);
+    return res == WAIT_FAILED;
+}
+
+
+void tomo_server_shutdown(TOMO_SERVER *serv)
+{
+    if (serv) {
+        serv->shouldquit = true;
+        SetEvent(serv->apc_evt);
+    }
+}
+
+
+/** @brief Slab destructor for connection objects */
+static void tomo_server_connection_clear(void *conn)
+{
+    tomo_connection_clear(conn);
+}
+
+
+/** @brief Stop @p rctr and release its connections. The shared sockets are
+ *      taken out of its multiplexer first so that they are only closed once
+ *  @param rctr
+ *      Reactor
+ */
+static void tomo_server_close_reactor(TOMO_REACTOR *rctr)
+{
+    TerminateThread(rctr->poller, 0);
+    CloseHandle(rctr->poller);
+    tomo_multiplexer_remove(&rctr->muxer, rctr->lisnr);
+    if (rctr->udpsock != TOMO_HANDLE_NONE) {
+        tomo_multiplexer_remove(&rctr->muxer, rctr->udpsock);
+    }
+    if (rctr->local != TOMO_HANDLE_NONE) {
+        tomo_multiplexer_remove(&rctr->muxer, rctr->local);
+    }
+    tomo_multiplexer_clear(&rctr->muxer);
+    tomo_slab_free(&rctr->connslab, tomo_server_connection_clear);
+}
+
+
+void tomo_server_close(TOMO_SERVER *serv)
+{
+    unsigned i;
+
+    CloseHandle(serv->apc_evt);
+    for (i = 0; i < serv->nreactors; i++) {
+        tomo_server_close_reactor(&serv->reactors[i]);
+    }
+    free(serv->reactors);
+    tomo_endpoint_close(&serv->listener);
+    if (serv->udp.sock != INVALID_SOCKET) {
+        tomo_endpoint_close(&serv->udp);
+    }
+    if (serv->local.sock != INVALID_SOCKET) {
+        tomo_endpoint_close(&serv->local);
+        DeleteFileW(serv->localpath);
+    }
+    tomo_mrntable_free(&serv->table);
+    WSACleanup();
+}
@@ -1,61 +1,115 @@
-#pragma once
-
-#ifndef TOMOSRV_SERVER_H
-#define TOMOSRV_SERVER_H
-
-#include "defines.h"
-#include "multiplex.h"
-#include "csv.h"
-
-
-typedef struct tomo_server {
-    WSADATA wsadata;
-
-    TOMO_MULTIPLEXER muxer;
-    TOMO_MRNTABLE table;
-
-    HANDLE monitor;
-    DWORD monid;
-
-    HANDLE poller;
-    DWORD pollid;
-
-    HANDLE apc_evt;
-    bool shouldquit;
-} TOMO_SERVER;
-
-
-/** @brief Prepares the initial state of the server
- *  @param serv
- *      Server state buffer
- *  @param port
- *      Port to open the initial listener on
- *  @returns Nonzero on error
- */
-int tomo_server_open(TOMO_SERVER *serv, u_short port, const wchar_t *path);
-
-
-/** @brief Runs the server
- *  @param serv
- *      Server state buffer
- *  @returns The application exit code, which will be nonzero on error. Error
- *      information can be obtained by tomo_error_strings
- */
-int tomo_server_run(TOMO_SERVER *serv);
-
-
-/** @brief Sets the shutdown flag and issues an event signal to the main thread
- *  @param serv
- *      Server state buffer. If this argument is NULL, this operation nops
- */
-void tomo_server_shutdown(TOMO_SERVER *serv);
-
-
-/** @brief Releases all resources held by @p serv
- *  @param serv
- *      Server state buffer
- */
-void tomo_server_close(TOMO_SERVER *serv);
-
-
-#endif /* TOMOSRV_SERVER_H */
+#pragma once
+
+#ifndef TOMOSRV_SERVER_H
+#define TOMOSRV_SERVER_H
+
+#include "defines.h"
+#include "multiplex.h"
+#include "structures/wheel.h"
+#include "csv.h"
+
+
+/** Longest idle or read timeout in seconds. Its milliseconds stay inside the
+ *  span of the timer wheel, and far from overflowing a DWORD
+ */
+#define TOMO_SERVER_MAXTIMEOUT ((unsigned)((TOMO_WHEEL_SPAN - 1) / 1000))
+
+
+/** Server configuration, filled out from the command line */
+typedef struct tomo_servconf {
+    u_short port;           /* Port to open the listener on */
+    u_short udp_port;       /* Port for single-datagram queries. Zero disables */
+    const wchar_t *local;   /* Path for an AF_UNIX listener, or NULL */
+    const wchar_t *path;    /* Path to the MOSAIQ schedule CSV */
+    const wchar_t *name_column; /* CSV header of the patient names */
+    const wchar_t *mrn_column;  /* CSV header of the MRNs */
+    unsigned nreactors;     /* Poller threads. Zero uses one per processor */
+    unsigned idle_timeout;  /* Seconds a client may sit idle. Zero disables */
+    unsigned read_timeout;  /* Seconds a client may take to finish a query line */
+    int backlog;            /* Listen backlog. Zero uses SOMAXCONN */
+    bool nodelay;           /* Set TCP_NODELAY on accepted connections */
+    bool frozen;            /* Freeze the MRN table into a perfect hash once loaded */
+} TOMO_SERVCONF;
+
+
+/** One poller thread and the connections it owns. Every reactor polls the same
+ *  (non-blocking) listener, and whichever wins the accept keeps the client
+ */
+typedef struct tomo_reactor {
+    struct tomo_server *serv;
+    unsigned idx;
+
+    TOMO_MULTIPLEXER muxer;
+    TOMO_HANDLE lisnr;      /* This reactor's copy of the listener */
+    TOMO_HANDLE udpsock;    /* This reactor's copy of the UDP socket, if any */
+    TOMO_HANDLE local;      /* This reactor's copy of the AF_UNIX listener */
+    TOMO_SLAB connslab;     /* TOMO_CONNECTION objects */
+    TOMO_WHEEL wheel;       /* Connection deadlines, in GetTickCount64 ms */
+
+    HANDLE poller;
+    DWORD pollid;
+
+    /* Written only by the poller, read by the monitor for the stats report */
+    volatile LONG conns;
+    volatile LONG accepts;
+    volatile LONG queries;
+} TOMO_REACTOR;
+
+
+typedef struct tomo_server {
+    WSADATA wsadata;
+
+    TOMO_ENDPOINT listener;
+    TOMO_ENDPOINT udp;      /* INVALID_SOCKET unless UDP queries are enabled */
+    TOMO_ENDPOINT local;    /* INVALID_SOCKET unless an AF_UNIX path was given */
+    const wchar_t *localpath;
+    TOMO_MRNTABLE table;    /* Shared read-only between reactors once loaded */
+
+    TOMO_REACTOR *reactors;
+    unsigned nreactors;
+
+    DWORD idle_ms, read_ms; /* Connection deadlines, zero if disabled */
+    bool nodelay;
+
+    HANDLE monitor;
+    DWORD monid;
+
+    HANDLE apc_evt;
+    bool shouldquit;
+} TOMO_SERVER;
+
+
+/** @brief Prepares the initial state of the server
+ *  @param serv
+ *      Server state buffer
+ *  @param conf
+ *      Server configuration
+ *  @returns Nonzero on error
+ */
+int tomo_server_open(TOMO_SERVER *serv, const TOMO_SERVCONF *conf);
+
+
+/** @brief Runs the server
+ *  @param serv
+ *      Server state buffer
+ *  @returns The application exit code, which will be nonzero on error. Error
+ *      information can be obtained by tomo_error_strings
+ */
+int tomo_server_run(TOMO_SERVER *serv);
+
+
+/** @brief Sets the shutdown flag and issues an event signal to the main thread
+ *  @param serv
+ *      Server state buffer. If this argument is NULL, this operation nops
+ */
+void tomo_server_shutdown(TOMO_SERVER *serv);
+
+
+/** @brief Releases all resources held by @p serv
+ *  @param serv
+ *      Server state buffer
+ */
+void tomo_server_close(TOMO_SERVER *serv);
+
+
+#endif /* TOMOSRV_SERVER_H */
@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "../error.h"
+
+
+struct tomo_arenachunk {
+    struct tomo_arenachunk *next;
+    size_t len, used;
+
+    /* Keeps data aligned for anything malloc would be */
+    union {
+        long double ld;
+        long long ll;
+        void *p;
+    } data[];
+};
+
+
+void tomo_arena_init(TOMO_ARENA *arena, size_t chunklen)
+{
+    memset(arena, 0, sizeof *arena);
+    arena->chunklen = (chunklen) ? chunklen : TOMO_ARENA_CHUNKLEN;
+}
+
+
+/** @brief Allocate a chunk with @p len bytes of space
+ *  @param arena
+ *      Arena, for statistics
+ *  @param len
+ *      Usable size
+ *  @returns The chunk, or NULL on error
+ */
+static struct tomo_arenachunk *tomo_arena_chunk(TOMO_ARENA *arena, size_t len)
+{
+    struct tomo_arenachunk *chunk;
+
+    chunk = malloc(sizeof *chunk + len);
+    if (!chunk) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed allocating arena chunk");
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->used = 0;
+    arena->nchunks++;
+    arena->reserved += len;
+    return chunk;
+}
+
+
+void *tomo_arena_alloc(TOMO_ARENA *arena, size_t len, size_t align)
+{
+    struct tomo_arenachunk *chunk = arena->head;
+    size_t off;
+
+    assert(align && !(align & (align - 1)));
+    if (!arena->chunklen) {
+        arena->chunklen = TOMO_ARENA_CHUNKLEN;
+    }
+    off = (chunk) ? (chunk->used + align - 1) & ~(align - 1) : 0;
+    if (!chunk || off + len > chunk->len) {
+        if (len > arena->chunklen / 4) {
+            /* Large blocks go behind the head, so its free tail stays usable */
+            chunk = tomo_arena_chunk(arena, len);
+            if (!chunk) {
+                return NULL;
+            }
+            chunk->used = len;
+            if (arena->head) {
+                chunk->next = arena->head->next;
+                arena->head->next = chunk;
+            } else {
+                arena->head = chunk;
+            }
+            arena->nallocs++;
+            arena->nbytes += len;
+            return chunk->data;
+        }
+        chunk = tomo_arena_chunk(arena, arena->chunklen);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = arena->head;
+        arena->head = chunk;
+        off = 0;
+    }
+    arena->nallocs++;
+    arena->nbytes += off + len - chunk->used;
+    chunk->used = off + len;
+    return (char *)chunk->data + off;
+}
+
+
+void tomo_arena_splice(TOMO_ARENA *dst, TOMO_ARENA *src)
+{
+    struct tomo_arenachunk *tail;
+
+    if (!src->head) {
+        return;
+    }
+    if (dst->head) {
+        /* Behind the head, which keeps being carved. The free tail of src's
+        head is given up */
+        for (tail = src->head; tail->next; tail = tail->next);
+        tail->next = dst->head->next;
+        dst->head->next = src->head;
+    } else {
+        dst->head = src->head;
+    }
+    dst->nallocs += src->nallocs;
+    dst->nbytes += src->nbytes;
+    dst->nchunks += src->nchunks;
+    dst->reserved += src->reserved;
+    tomo_arena_init(src, src->chunklen);
+}
+
+
+void tomo_arena_free(TOMO_ARENA *arena)
+{
+    struct tomo_arenachunk *chunk, *next;
+    const size_t chunklen = arena->chunklen;
+
+    for (chunk = arena->head; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    tomo_arena_init(arena, chunklen);
+}
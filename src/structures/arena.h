@@ -0,0 +1,75 @@
+#pragma once
+
+#ifndef TOMOSRV_ARENA_H
+#define TOMOSRV_ARENA_H
+
+#include "../defines.h"
+#include <stddef.h>
+
+
+/** Default chunk size. Allocations larger than a quarter of this get a chunk
+ *  of their own
+ */
+#define TOMO_ARENA_CHUNKLEN (1UL << 20)
+
+
+struct tomo_arenachunk;
+
+
+/** Bump allocator. Memory is carved sequentially out of large chunks and can
+ *  only be released all at once, which costs one free per chunk
+ */
+typedef struct tomo_arena {
+    struct tomo_arenachunk *head;   /* Chunk being carved, the rest follow it */
+    size_t chunklen;
+
+    /* Statistics */
+    size_t nallocs;     /* Successful allocations */
+    size_t nbytes;      /* Bytes handed out, including alignment padding */
+    size_t nchunks;     /* Chunks held */
+    size_t reserved;    /* Bytes held in chunks */
+} TOMO_ARENA;
+
+
+/** @brief Initialize an empty arena. No memory is allocated until the first
+ *      allocation
+ *  @param arena
+ *      Arena
+ *  @param chunklen
+ *      Chunk size, or zero for TOMO_ARENA_CHUNKLEN
+ */
+void tomo_arena_init(TOMO_ARENA *arena, size_t chunklen);
+
+
+/** @brief Allocate @p len bytes from @p arena
+ *  @param arena
+ *      Arena
+ *  @param len
+ *      Number of bytes
+ *  @param align
+ *      Required alignment, a power of two no greater than that of malloc
+ *  @returns A pointer to uninitialized memory, or NULL on error
+ */
+void *tomo_arena_alloc(TOMO_ARENA *arena, size_t len, size_t align);
+
+
+/** @brief Move every chunk held by @p src into @p dst, which takes over their
+ *      statistics too. Memory allocated from @p src stays valid for as long as
+ *      @p dst is, and @p src is left empty
+ *  @param dst
+ *      Arena to move chunks into
+ *  @param src
+ *      Arena to move chunks out of
+ */
+void tomo_arena_splice(TOMO_ARENA *dst, TOMO_ARENA *src);
+
+
+/** @brief Release every chunk held by @p arena, and reset it to empty. Safe to
+ *      call on a zeroed arena
+ *  @param arena
+ *      Arena
+ */
+void tomo_arena_free(TOMO_ARENA *arena);
+
+
+#endif /* TOMOSRV_ARENA_H */
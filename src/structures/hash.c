@@ -0,0 +1,36 @@
+#include "hash.h"
+#include "../error.h"
+
+
+int tomo_hash_init(void)
+{
+#if TOMO_HASH_CRC
+    int info[4];
+
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 20))) {
+        /* SSE4.2 */
+        tomo_error_raise(TOMO_ERROR_USER,
+                         L"Built with TOMO_HASH_CRC for SSE4.2, which this processor lacks",
+                         L"Cannot hash table keys");
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+
+const wchar_t *tomo_hash_name(void)
+{
+#if TOMO_HASH_CRC
+    return L"CRC32C";
+#else
+    return L"multiply-fold";
+#endif
+}
+
+
+unsigned long long tomo_hash64(const void *key, size_t len)
+{
+    return tomo_hash_mix(key, len);
+}
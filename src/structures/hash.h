@@ -0,0 +1,156 @@
+#pragma once
+
+#ifndef TOMOSRV_HASH_H
+#define TOMOSRV_HASH_H
+
+#include "../defines.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <intrin.h>
+
+/* Hash with CRC32C (1) or the portable multiply-fold (0). The choice is made
+at compile time, so that tables inline the hash into their probes, and
+tomo_hash_init() refuses to run a CRC32C build on a processor without SSE4.2.
+The CMake build sets this from its TOMO_HASH_CRC option, which is on. Left
+undefined, it follows whether the compiler may assume SSE4.2 (/arch:AVX and
+up, or -msse4.2) */
+#ifndef TOMO_HASH_CRC
+#   if defined(__SSE4_2__) || defined(__AVX__)
+#       define TOMO_HASH_CRC 1
+#   else
+#       define TOMO_HASH_CRC 0
+#   endif
+#endif
+
+/* Odd 64-bit constants with well-spread bits (from wyhash) */
+#define TOMO_HASH_P0 0xa0761d6478bd642fULL
+#define TOMO_HASH_P1 0xe7037ed1a0b428dbULL
+#define TOMO_HASH_P2 0x8ebc6af09c88c6e3ULL
+
+
+/** @brief Check that this processor runs the hash the build was compiled
+ *      with. Call this once at startup, before anything is hashed
+ *  @returns Nonzero on error
+ */
+int tomo_hash_init(void);
+
+
+/** @brief Get a short name for the hash implementation in use, for logs */
+const wchar_t *tomo_hash_name(void);
+
+
+/** @brief Multiply @p a by @p b to 128 bits and fold the halves together. This
+ *      is what does the mixing: each output bit depends on every input bit
+ */
+static inline unsigned long long tomo_hash_mum(unsigned long long a,
+                                               unsigned long long b)
+#if defined(_M_X64)
+{
+    unsigned long long hi, lo;
+
+    lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+}
+#else
+{
+    const unsigned long long al = a & 0xFFFFFFFF, ah = a >> 32;
+    const unsigned long long bl = b & 0xFFFFFFFF, bh = b >> 32;
+    const unsigned long long ll = al * bl, lh = al * bh;
+    const unsigned long long hl = ah * bl, hh = ah * bh;
+    unsigned long long mid, lo, hi;
+
+    mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    lo = (mid << 32) | (ll & 0xFFFFFFFF);
+    hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return lo ^ hi;
+}
+#endif
+
+
+/** @brief Read the @p len < 8 trailing bytes at @p p into a zero-padded word */
+static inline unsigned long long tomo_hash_tail(const unsigned char *p, size_t len)
+{
+    unsigned long long w = 0;
+
+    memcpy(&w, p, len);
+    return w;
+}
+
+
+/** @brief Portable hash: one multiply-fold per 8-byte word */
+static inline unsigned long long tomo_hash_mix(const void *key, size_t len)
+{
+    const unsigned char *p = key;
+    unsigned long long h = TOMO_HASH_P0 ^ len, w;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, sizeof w);
+        h = tomo_hash_mum(h ^ w, TOMO_HASH_P1);
+    }
+    return tomo_hash_mum(h ^ tomo_hash_tail(p, len), TOMO_HASH_P2);
+}
+
+
+#if TOMO_HASH_CRC
+/** @brief SSE4.2 hash: CRC32C over 8-byte words, then one multiply-fold to
+ *      spread the (linear, 32-bit) CRC across all output bits
+ */
+static inline unsigned long long tomo_hash_crc(const void *key, size_t len)
+{
+    const unsigned char *p = key;
+    unsigned long long w, crc = 0xFFFFFFFF;
+    const size_t total = len;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, sizeof w);
+#if defined(_M_X64) || defined(__x86_64__)
+        crc = _mm_crc32_u64(crc, w);
+#else
+        crc = _mm_crc32_u32((unsigned)crc, (unsigned)w);
+        crc = _mm_crc32_u32((unsigned)crc, (unsigned)(w >> 32));
+#endif
+    }
+    for (; len; p++, len--) {
+        crc = _mm_crc32_u8((unsigned)crc, *p);
+    }
+    return tomo_hash_mum(crc ^ ((unsigned long long)total << 32), TOMO_HASH_P1);
+}
+#endif
+
+
+/** @brief Hash @p len bytes at @p key, with the implementation chosen by
+ *      TOMO_HASH_CRC. The input is consumed a word at a time, and every output
+ *      bit depends on every input bit, so callers are free to take low bits
+ *      for a bucket index and high bits for a fingerprint (or the other way
+ *      around)
+ *  @param key
+ *      Bytes to hash
+ *  @param len
+ *      Number of bytes
+ *  @returns 64-bit hash
+ */
+static inline unsigned long long tomo_hash(const void *key, size_t len)
+{
+#if TOMO_HASH_CRC
+    return tomo_hash_crc(key, len);
+#else
+    return tomo_hash_mix(key, len);
+#endif
+}
+
+
+/** @brief Hash @p len bytes at @p key to 64 bits. Unlike tomo_hash(), this
+ *      does not depend on the build, so keys keep their hash whichever
+ *      implementation TOMO_HASH_CRC picks. Distinct keys in a set of millions
+ *      practically never collide, which perfect hashing relies on
+ *  @param key
+ *      Bytes to hash
+ *  @param len
+ *      Number of bytes
+ *  @returns 64-bit hash
+ */
+unsigned long long tomo_hash64(const void *key, size_t len);
+
+
+#endif /* TOMOSRV_HASH_H */
@@ -0,0 +1,704 @@
+/** Type-specialized open addressing hash map, generated by including this file
+ *  with the parameters below defined. Include it once where the types are
+ *  needed, to declare them, and once more with TOMO_MAP_IMPLEMENT defined in
+ *  the translation unit that owns the map, to define its functions there. The
+ *  hash and equality are macros, so every instantiation compiles down to code
+ *  written for its key type, with no function pointers on the probe path
+ *
+ *  Always required:
+ *      TOMO_MAP_NAME       Prefix of the generated functions, e.g. tomo_mrnmap
+ *      TOMO_MAP_TYPE       Name of the generated map type
+ *      TOMO_MAP_ENTRY      Name of the generated entry type, { key, val }
+ *      TOMO_MAP_KEY        Type of the stored keys
+ *      TOMO_MAP_VAL        Type of the stored values
+ *
+ *  Required with TOMO_MAP_IMPLEMENT:
+ *      TOMO_MAP_HASH(k)    64-bit hash of key argument k. The low 7 bits are
+ *                          the fingerprint, and the high 32 pick the bucket
+ *      TOMO_MAP_EQ(s, k)   Nonzero if stored key s equals key argument k
+ *
+ *  Optional with TOMO_MAP_IMPLEMENT:
+ *      TOMO_MAP_KEYARG     Type keys are passed in as (default TOMO_MAP_KEY)
+ *      TOMO_MAP_PREFETCH(e)  Prefetch whatever entry pointer e refers to, for
+ *                          keys that point elsewhere (default nothing)
+ *
+ *  Every parameter is undefined again at the end of this file
+ *
+ *  Buckets are probed linearly, one group of TOMO_MAP_GROUP control bytes at
+ *  a time. A control byte holds the low 7 bits of the hash of a full bucket,
+ *  or has its sign bit set when the bucket is empty, so a probe only compares
+ *  the keys whose fingerprint matches. Entries are placed Robin Hood style and
+ *  removed by backward shift, so no tombstones are left. A map can also grow
+ *  incrementally, see TOMO_MAP_MIGRATE
+ */
+#ifndef TOMOSRV_MAP_H
+#define TOMOSRV_MAP_H
+
+#include "../defines.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <intrin.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define TOMO_MAP_SSE2 1
+#   include <emmintrin.h>
+#   define tomo_prefetch(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#   define TOMO_MAP_SSE2 0
+#   define tomo_prefetch(p) ((void)(p))
+#endif
+
+
+/** Number of control bytes tested by one probe step */
+#define TOMO_MAP_GROUP 16
+
+/** Number of keys a batched lookup keeps in flight at once */
+#define TOMO_MAP_BATCH 32
+
+/** Least number of entries that each add or remove moves over while the map
+ *  grows incrementally. The old arrays hold 7/8 of their length when growth
+ *  starts, and the new ones take as many adds again before they are full, so
+ *  anything from 2 up has the old arrays drained well before then
+ */
+#define TOMO_MAP_MIGRATE 8
+
+/** Control byte of an empty bucket. Full buckets hold a 7-bit fingerprint, so
+ *  their sign bit is always clear
+ */
+#define TOMO_CTRL_EMPTY ((signed char)-128)
+
+#define TOMO_MAP_CAT2(a, b) a##_##b
+#define TOMO_MAP_CAT(a, b) TOMO_MAP_CAT2(a, b)
+
+
+/** @brief Split off the control byte fingerprint of @p hash, from its low bits */
+static inline signed char tomo_ctrl_hash(unsigned long long hash)
+{
+    return (signed char)(hash & 0x7F);
+}
+
+
+/** @brief Get the home bucket of @p hash, before it is reduced modulo the map
+ *      length. This comes from the high half, which shares no bits with the
+ *      fingerprint however large the map grows
+ */
+static inline unsigned tomo_map_home(unsigned long long hash)
+{
+    return (unsigned)(hash >> 32);
+}
+
+
+/** @brief Get a mask with bit i set for every control byte i of the group at
+ *      @p ctrl equal to @p byte
+ */
+static inline unsigned tomo_ctrl_match(const signed char *ctrl, signed char byte)
+#if TOMO_MAP_SSE2
+{
+    const __m128i grp = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8(byte)));
+}
+#else
+{
+    unsigned i, mask = 0;
+
+    for (i = 0; i < TOMO_MAP_GROUP; i++) {
+        mask |= (unsigned)(ctrl[i] == byte) << i;
+    }
+    return mask;
+}
+#endif
+
+
+/** @brief Get a mask with bit i set for every empty bucket i of the group at
+ *      @p ctrl
+ */
+static inline unsigned tomo_ctrl_empty(const signed char *ctrl)
+#if TOMO_MAP_SSE2
+{
+    /* Only empty buckets have the sign bit set */
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+{
+    unsigned i, mask = 0;
+
+    for (i = 0; i < TOMO_MAP_GROUP; i++) {
+        mask |= (unsigned)(ctrl[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+
+/** @brief Get the index of the lowest set bit in nonzero @p mask */
+static inline unsigned tomo_ctz(unsigned mask)
+{
+    unsigned long idx;
+
+    _BitScanForward(&idx, mask);
+    return idx;
+}
+
+
+/** @brief Rounds @p x up to the next highest power of two, using ancient two's
+ *      complement bit-twiddling techniques. I fetched/adapted this code from
+ *      one of the bajillion answers of its kind on good old Stack Overflow
+ *  @param x
+ *      Value to round up
+ *  @returns The first power of two not less than @p x (could be equal to x!)
+ */
+static inline unsigned tomo_map_pow2(unsigned x)
+{
+    x--;
+    x |= x >> 16;
+    x |= x >> 8;
+    x |= x >> 4;
+    x |= x >> 2;
+    x |= x >> 1;
+    return x + 1;
+}
+
+
+#endif /* TOMOSRV_MAP_H */
+
+
+#define TOMO_MAP_FN(f) TOMO_MAP_CAT(TOMO_MAP_NAME, f)
+
+#ifndef TOMO_MAP_IMPLEMENT
+
+typedef struct {
+    TOMO_MAP_KEY key;
+    TOMO_MAP_VAL val;
+} TOMO_MAP_ENTRY;
+
+
+typedef struct {
+    unsigned len, load;
+    TOMO_MAP_ENTRY *table;
+    unsigned long long *hashes; /* Hash of each full bucket, allocated with table */
+
+    /* len + TOMO_MAP_GROUP bytes, allocated with table. The tail mirrors the
+    first group so that a group starting near the end never wraps */
+    signed char *ctrl;
+
+    /* Arrays being drained by an incremental resize. table is NULL when none
+    is in progress. They remain a map of the load entries not yet moved: the
+    walk from start (an empty bucket) only ever stops at an empty bucket, so a
+    cluster is moved all at once, and leaves no probe sequence broken behind */
+    struct {
+        TOMO_MAP_ENTRY *table;
+        unsigned long long *hashes;
+        signed char *ctrl;
+        unsigned len, load, start, done;
+    } old;
+
+    unsigned resizes;   /* Times entries were rehashed into larger arrays */
+} TOMO_MAP_TYPE;
+
+#else /* TOMO_MAP_IMPLEMENT */
+
+#include "../error.h"
+
+#ifndef TOMO_MAP_KEYARG
+#   define TOMO_MAP_KEYARG TOMO_MAP_KEY
+#endif
+
+#ifndef TOMO_MAP_PREFETCH
+#   define TOMO_MAP_PREFETCH(e) ((void)(e))
+#endif
+
+typedef TOMO_MAP_KEYARG TOMO_MAP_FN(karg);
+
+
+/** @brief Hash @p key */
+static inline unsigned long long TOMO_MAP_FN(hash)(TOMO_MAP_KEYARG key)
+{
+    return TOMO_MAP_HASH(key);
+}
+
+
+/** @brief Modulo with the table size, made trivial by the invariant that
+ *      map->len is a power of two
+ */
+static inline unsigned TOMO_MAP_FN(mod)(const TOMO_MAP_TYPE *map, unsigned x)
+{
+    return x & (map->len - 1);
+}
+
+
+/** @brief Set the control byte of bucket @p idx, and its mirror if it has one */
+static inline void TOMO_MAP_FN(ctrl_set)(TOMO_MAP_TYPE *map,
+                                         unsigned       idx,
+                                         signed char    byte)
+{
+    map->ctrl[idx] = byte;
+    if (idx < TOMO_MAP_GROUP) {
+        map->ctrl[map->len + idx] = byte;
+    }
+}
+
+
+/** @brief Find @p key in @p map. Removal leaves no holes, so every bucket on
+ *      the probe sequence before the one holding @p key is full, and the first
+ *      empty bucket ends the search
+ *  @param map
+ *      Map
+ *  @param key
+ *      Key
+ *  @param hash
+ *      Hash of @p key
+ *  @returns The index of the bucket containing @p key, or of the first empty
+ *      bucket on its probe sequence
+ */
+static inline unsigned TOMO_MAP_FN(find)(const TOMO_MAP_TYPE *map,
+                                         TOMO_MAP_KEYARG      key,
+                                         unsigned long long   hash)
+{
+    const signed char h2 = tomo_ctrl_hash(hash);
+    unsigned pos, match, empty, idx;
+
+    pos = TOMO_MAP_FN(mod)(map, tomo_map_home(hash));
+    for (;;) {
+        match = tomo_ctrl_match(&map->ctrl[pos], h2);
+        empty = tomo_ctrl_empty(&map->ctrl[pos]);
+        if (empty) {
+            /* Nothing past the first empty bucket is on this probe sequence */
+            match &= (empty & (0U - empty)) - 1;
+        }
+        while (match) {
+            idx = TOMO_MAP_FN(mod)(map, pos + tomo_ctz(match));
+            if (TOMO_MAP_EQ(map->table[idx].key, key)) {
+                return idx;
+            }
+            match &= match - 1;
+        }
+        if (empty) {
+            return TOMO_MAP_FN(mod)(map, pos + tomo_ctz(empty));
+        }
+        pos = TOMO_MAP_FN(mod)(map, pos + TOMO_MAP_GROUP);
+    }
+}
+
+
+/** @brief Get how far the entry in full bucket @p idx sits from its home */
+static inline unsigned TOMO_MAP_FN(dist)(const TOMO_MAP_TYPE *map, unsigned idx)
+{
+    return TOMO_MAP_FN(mod)(map, idx - tomo_map_home(map->hashes[idx]));
+}
+
+
+/** @brief Place @p entry, whose key is known not to be in @p map, Robin Hood
+ *      style. Walking from its home bucket, it takes the first empty bucket,
+ *      or the bucket of the first entry closer to its own home than the walk
+ *      has come, which then carries on in its place. Every bucket from an
+ *      entry's home up to the entry stays full, so lookups are unchanged
+ *  @param map
+ *      Map with room for another entry
+ *  @param entry
+ *      Entry to place
+ *  @param hash
+ *      Hash of its key
+ *  @returns The bucket @p entry ended up in
+ */
+static unsigned TOMO_MAP_FN(place)(TOMO_MAP_TYPE      *map,
+                                   TOMO_MAP_ENTRY      entry,
+                                   unsigned long long  hash)
+{
+    unsigned idx, dist, d, res = UINT_MAX;
+    unsigned long long tmph;
+    TOMO_MAP_ENTRY tmp;
+
+    idx = TOMO_MAP_FN(mod)(map, tomo_map_home(hash));
+    for (dist = 0;; dist++, idx = TOMO_MAP_FN(mod)(map, idx + 1)) {
+        if (map->ctrl[idx] == TOMO_CTRL_EMPTY) {
+            map->table[idx] = entry;
+            map->hashes[idx] = hash;
+            TOMO_MAP_FN(ctrl_set)(map, idx, tomo_ctrl_hash(hash));
+            return (res == UINT_MAX) ? idx : res;
+        }
+        d = TOMO_MAP_FN(dist)(map, idx);
+        if (d < dist) {
+            tmp = map->table[idx];
+            tmph = map->hashes[idx];
+            map->table[idx] = entry;
+            map->hashes[idx] = hash;
+            TOMO_MAP_FN(ctrl_set)(map, idx, tomo_ctrl_hash(hash));
+            entry = tmp;
+            hash = tmph;
+            dist = d;
+            res = (res == UINT_MAX) ? idx : res;
+        }
+    }
+}
+
+
+/** @brief Empty full bucket @p idx by backward shift: each following entry
+ *      that is not in its home bucket moves back by one, up to the next empty
+ *      bucket or entry at home. No tombstone is left behind
+ *  @param map
+ *      Map
+ *  @param idx
+ *      Bucket to empty
+ */
+static void TOMO_MAP_FN(erase)(TOMO_MAP_TYPE *map, unsigned idx)
+{
+    unsigned next;
+
+    for (;;) {
+        next = TOMO_MAP_FN(mod)(map, idx + 1);
+        if (map->ctrl[next] == TOMO_CTRL_EMPTY || !TOMO_MAP_FN(dist)(map, next)) {
+            break;
+        }
+        map->table[idx] = map->table[next];
+        map->hashes[idx] = map->hashes[next];
+        TOMO_MAP_FN(ctrl_set)(map, idx, map->ctrl[next]);
+        idx = next;
+    }
+    memset(&map->table[idx], 0, sizeof map->table[idx]);
+    TOMO_MAP_FN(ctrl_set)(map, idx, TOMO_CTRL_EMPTY);
+}
+
+
+/** @brief Get a map over the arrays that an incremental resize is draining.
+ *  Its pointers are shared with @p map, so lookups and removals through it go
+ *  to the old arrays themselves
+ */
+static inline TOMO_MAP_TYPE TOMO_MAP_FN(old_view)(const TOMO_MAP_TYPE *map)
+{
+    const TOMO_MAP_TYPE view = {
+        .len = map->old.len,
+        .load = map->old.load,
+        .table = map->old.table,
+        .hashes = map->old.hashes,
+        .ctrl = map->old.ctrl
+    };
+
+    return view;
+}
+
+
+/** @brief Move at least @p count entries of an incremental resize into the new
+ *      arrays, or all that are left, and release the old arrays once they are
+ *      empty. Moved buckets are emptied behind the walk
+ *  @param map
+ *      Map, which may or may not be resizing
+ *  @param count
+ *      Least number of entries to move
+ */
+static void TOMO_MAP_FN(migrate)(TOMO_MAP_TYPE *map, unsigned count)
+{
+    TOMO_MAP_TYPE old = TOMO_MAP_FN(old_view)(map);
+    unsigned idx, moved = 0;
+
+    while (map->old.load) {
+        idx = TOMO_MAP_FN(mod)(&old, map->old.start + map->old.done);
+        if (old.ctrl[idx] != TOMO_CTRL_EMPTY) {
+            TOMO_MAP_FN(place)(map, old.table[idx], old.hashes[idx]);
+            TOMO_MAP_FN(ctrl_set)(&old, idx, TOMO_CTRL_EMPTY);
+            map->old.load--;
+            moved++;
+        } else if (moved >= count) {
+            /* The end of a cluster */
+            return;
+        }
+        map->old.done++;
+    }
+    free(map->old.table);
+    memset(&map->old, 0, sizeof map->old);
+}
+
+
+/** @brief Change the capacity of @p map. An incremental resize only sets up
+ *      the new arrays here, and leaves the entries for migrate to move
+ *  @param map
+ *      Map
+ *  @param newlen
+ *      New length of the map. This should be larger than the current length,
+ *      and a power of two no less than TOMO_MAP_GROUP
+ *  @param incremental
+ *      Whether to resize incrementally
+ *  @returns Nonzero on error
+ */
+static int TOMO_MAP_FN(realloc)(TOMO_MAP_TYPE *map, unsigned newlen, bool incremental)
+{
+    TOMO_MAP_TYPE next = {
+        .len = newlen,
+        .load = map->load,
+        .resizes = map->resizes + (map->load != 0)
+    };
+    unsigned i;
+
+    if (map->old.table) {
+        /* Only one resize is ever in flight */
+        TOMO_MAP_FN(migrate)(map, UINT_MAX);
+    }
+    next.table = calloc(1UL, newlen * (sizeof *next.table + sizeof *next.hashes)
+                           + newlen + TOMO_MAP_GROUP);
+    if (!next.table) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed reallocating hash map");
+        return 1;
+    }
+    next.hashes = (unsigned long long *)(next.table + newlen);
+    next.ctrl = (signed char *)(next.hashes + newlen);
+    memset(next.ctrl, TOMO_CTRL_EMPTY, newlen + TOMO_MAP_GROUP);
+    if (incremental && map->load) {
+        next.old.table = map->table;
+        next.old.hashes = map->hashes;
+        next.old.ctrl = map->ctrl;
+        next.old.len = map->len;
+        next.old.load = map->load;
+        /* A map below its load limit always has an empty bucket */
+        while (map->ctrl[next.old.start] != TOMO_CTRL_EMPTY) {
+            next.old.start++;
+        }
+        *map = next;
+        return 0;
+    }
+    /* The keys are known to be unique, so no comparisons are needed */
+    for (i = 0; i < map->len; i++) {
+        if (map->ctrl[i] != TOMO_CTRL_EMPTY) {
+            TOMO_MAP_FN(place)(&next, map->table[i], map->hashes[i]);
+        }
+    }
+    free(map->table);
+    *map = next;
+    return 0;
+}
+
+
+/** @brief Free the arrays of @p map and zero it. This is safe on a zeroed map */
+static void TOMO_MAP_FN(free)(TOMO_MAP_TYPE *map)
+{
+    static const TOMO_MAP_TYPE zero = { 0 };
+
+    free(map->table);
+    free(map->old.table);
+    *map = zero;
+}
+
+
+/** @brief Initialize @p map to at least @p minsize capacity, freeing it first
+ *  @param map
+ *      Map, initialized or zeroed
+ *  @param minsize
+ *      Minimum initial size. This is rounded up to the first power of two not
+ *      less than its value (and no less than TOMO_MAP_GROUP)
+ *  @returns Nonzero on error
+ */
+static int TOMO_MAP_FN(init)(TOMO_MAP_TYPE *map, unsigned minsize)
+{
+    TOMO_MAP_FN(free)(map);
+    return TOMO_MAP_FN(realloc)(map,
+                                tomo_map_pow2((minsize > TOMO_MAP_GROUP) ? minsize
+                                                                         : TOMO_MAP_GROUP),
+                                false);
+}
+
+
+/** @brief Grow @p map so that it holds @p count entries without passing its
+ *      load limit, which spares the resizes that adding them one at a time
+ *      would go through. A map already that large is left alone
+ *  @param map
+ *      Map
+ *  @param count
+ *      Number of entries to make room for, including those already in @p map
+ *  @returns Nonzero on error, including a @p count too large for any map
+ */
+static int TOMO_MAP_FN(reserve)(TOMO_MAP_TYPE *map, unsigned count)
+{
+    /* One past the count, as add resizes upon reaching the limit. Doubling
+    until it fits keeps the length a power of two */
+    const unsigned long long need = ((unsigned long long)count + 1) * 8 / 7 + 1;
+    unsigned newlen = (map->len > TOMO_MAP_GROUP) ? map->len : TOMO_MAP_GROUP;
+
+    while (newlen < need) {
+        if (newlen > UINT_MAX / 4) {
+            tomo_error_raise(TOMO_ERROR_USER, L"Too many entries", L"Cannot reserve hash map");
+            return 1;
+        }
+        newlen *= 2;
+    }
+    return (newlen > map->len) ? TOMO_MAP_FN(realloc)(map, newlen, false) : 0;
+}
+
+
+/** @brief Get the entry for @p key. While the map grows incrementally, a key
+ *      missing from the new arrays is looked for in the old ones
+ *  @param map
+ *      Map
+ *  @param key
+ *      Key
+ *  @param hash
+ *      Hash of @p key
+ *  @returns The entry, or NULL if @p key is not in @p map
+ */
+static TOMO_MAP_ENTRY *TOMO_MAP_FN(get)(TOMO_MAP_TYPE      *map,
+                                        TOMO_MAP_KEYARG     key,
+                                        unsigned long long  hash)
+{
+    TOMO_MAP_TYPE old;
+    unsigned idx;
+
+    idx = TOMO_MAP_FN(find)(map, key, hash);
+    if (map->ctrl[idx] != TOMO_CTRL_EMPTY) {
+        return &map->table[idx];
+    }
+    if (!map->old.table) {
+        return NULL;
+    }
+    old = TOMO_MAP_FN(old_view)(map);
+    idx = TOMO_MAP_FN(find)(&old, key, hash);
+    return (old.ctrl[idx] != TOMO_CTRL_EMPTY) ? &old.table[idx] : NULL;
+}
+
+
+/** @brief Get the entries for every key in @p keys. Keys are taken
+ *      TOMO_MAP_BATCH at a time: the whole batch is hashed and the memory each
+ *      key will touch is prefetched before any of them is resolved, so the
+ *      cache misses overlap instead of stalling one after the other
+ *  @param map
+ *      Map
+ *  @param keys
+ *      Keys to look up
+ *  @param count
+ *      Number of keys
+ *  @param entries
+ *      Array of @p count results, each as get would return
+ */
+static void TOMO_MAP_FN(get_many)(TOMO_MAP_TYPE                 *map,
+                                  const TOMO_MAP_FN(karg)       *keys,
+                                  size_t                         count,
+                                  const TOMO_MAP_ENTRY         **entries)
+{
+    unsigned long long hash[TOMO_MAP_BATCH];
+    unsigned cand[TOMO_MAP_BATCH];
+    unsigned pos, match;
+    size_t i, n;
+
+    for (; count; keys += n, entries += n, count -= n) {
+        n = (count < TOMO_MAP_BATCH) ? count : TOMO_MAP_BATCH;
+        /* Each pass only touches memory the previous one prefetched */
+        for (i = 0; i < n; i++) {
+            hash[i] = TOMO_MAP_HASH(keys[i]);
+            tomo_prefetch(&map->ctrl[TOMO_MAP_FN(mod)(map, tomo_map_home(hash[i]))]);
+        }
+        for (i = 0; i < n; i++) {
+            pos = TOMO_MAP_FN(mod)(map, tomo_map_home(hash[i]));
+            match = tomo_ctrl_match(&map->ctrl[pos], tomo_ctrl_hash(hash[i]));
+            cand[i] = (match) ? TOMO_MAP_FN(mod)(map, pos + tomo_ctz(match)) : UINT_MAX;
+            if (match) {
+                tomo_prefetch(&map->table[cand[i]]);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            if (cand[i] != UINT_MAX) {
+                TOMO_MAP_PREFETCH(&map->table[cand[i]]);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            entries[i] = TOMO_MAP_FN(get)(map, keys[i], hash[i]);
+        }
+    }
+}
+
+
+/** @brief Add @p entry, whose key is known not to be in @p map, and grow the
+ *      map if that takes it past its load limit. An incremental resize in
+ *      progress moves another TOMO_MAP_MIGRATE entries first
+ *  @param map
+ *      Map
+ *  @param entry
+ *      Entry to add
+ *  @param hash
+ *      Hash of its key
+ *  @param incremental
+ *      If the map has to grow, whether to do so incrementally, so that this
+ *      add does not pay for rehashing every entry at once
+ *  @returns Nonzero on error. The entry is in the map either way
+ */
+static int TOMO_MAP_FN(add)(TOMO_MAP_TYPE      *map,
+                            TOMO_MAP_ENTRY      entry,
+                            unsigned long long  hash,
+                            bool                incremental)
+{
+    /* The load limit is 7/8 of capacity. Group probing stays short at much
+    higher loads than probing one bucket at a time */
+    const unsigned num = 7, denom = 8;
+
+    if (map->old.table) {
+        TOMO_MAP_FN(migrate)(map, TOMO_MAP_MIGRATE);
+    }
+    TOMO_MAP_FN(place)(map, entry, hash);
+    map->load++;
+    if (map->load >= (unsigned)(((unsigned long long)num * map->len) / denom)) {
+        return TOMO_MAP_FN(realloc)(map, map->len * 2, incremental);
+    }
+    return 0;
+}
+
+
+/** @brief Remove @p key from @p map. An incremental resize in progress moves
+ *      another TOMO_MAP_MIGRATE entries first, and a key it has yet to move is
+ *      removed from the old arrays, which stay a map of their own
+ *  @param map
+ *      Map
+ *  @param key
+ *      Key
+ *  @param hash
+ *      Hash of @p key
+ *  @returns Zero if @p key was removed, and nonzero if it was not there
+ */
+static int TOMO_MAP_FN(remove)(TOMO_MAP_TYPE      *map,
+                               TOMO_MAP_KEYARG     key,
+                               unsigned long long  hash)
+{
+    TOMO_MAP_TYPE old;
+    unsigned idx;
+
+    if (map->old.table) {
+        TOMO_MAP_FN(migrate)(map, TOMO_MAP_MIGRATE);
+    }
+    idx = TOMO_MAP_FN(find)(map, key, hash);
+    if (map->ctrl[idx] != TOMO_CTRL_EMPTY) {
+        TOMO_MAP_FN(erase)(map, idx);
+        map->load--;
+        return 0;
+    }
+    if (!map->old.table) {
+        return 1;
+    }
+    old = TOMO_MAP_FN(old_view)(map);
+    idx = TOMO_MAP_FN(find)(&old, key, hash);
+    if (old.ctrl[idx] == TOMO_CTRL_EMPTY) {
+        return 1;
+    }
+    /* Shifting back stays inside the cluster, which the walk has either
+    moved whole or not touched yet */
+    TOMO_MAP_FN(erase)(&old, idx);
+    map->old.load--;
+    map->load--;
+    if (!map->old.load) {
+        TOMO_MAP_FN(migrate)(map, 0);
+    }
+    return 0;
+}
+
+#undef TOMO_MAP_IMPLEMENT
+#undef TOMO_MAP_HASH
+#undef TOMO_MAP_EQ
+#undef TOMO_MAP_KEYARG
+#undef TOMO_MAP_PREFETCH
+
+#endif /* TOMO_MAP_IMPLEMENT */
+
+#undef TOMO_MAP_FN
+#undef TOMO_MAP_NAME
+#undef TOMO_MAP_TYPE
+#undef TOMO_MAP_ENTRY
+#undef TOMO_MAP_KEY
+#undef TOMO_MAP_VAL
@@ -0,0 +1,145 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "slab.h"
+#include "../error.h"
+
+
+/** Slot header, placed immediately before each object. While the slot is live,
+ *  hndl is its handle. While it is free, hndl is the handle it will be issued
+ *  under next, and next links the free list
+ */
+struct tomo_slot {
+    TOMO_HANDLE hndl;
+    unsigned next;
+};
+
+
+/** @brief Get the header of slot @p idx */
+static struct tomo_slot *tomo_slab_slot(const TOMO_SLAB *slab, unsigned idx)
+{
+    char *chunk = slab->chunks[idx / TOMO_SLAB_CHUNKLEN];
+
+    return (struct tomo_slot *)(chunk + (idx % TOMO_SLAB_CHUNKLEN) * slab->stride);
+}
+
+
+void tomo_slab_init(TOMO_SLAB *slab, size_t objsize)
+{
+    static const TOMO_SLAB zero = { 0 };
+    const size_t align = sizeof (void *);
+
+    *slab = zero;
+    slab->stride = (sizeof (struct tomo_slot) + objsize + align - 1) & ~(align - 1);
+}
+
+
+/** @brief Add a chunk to @p slab and thread its slots onto the free list
+ *  @param slab
+ *      Slab
+ *  @returns Nonzero on error
+ */
+static int tomo_slab_grow(TOMO_SLAB *slab)
+{
+    static const wchar_t *failmsg = L"Cannot grow slab";
+    struct tomo_slot *slot;
+    char **chunks, *chunk;
+    unsigned i;
+
+    if (slab->cap + TOMO_SLAB_CHUNKLEN > TOMO_HANDLE_IDXMASK) {
+        tomo_error_raise(TOMO_ERROR_USER, L"Handle space exhausted", failmsg);
+        return 1;
+    }
+    chunks = realloc(slab->chunks, sizeof *chunks * (slab->nchunks + 1));
+    if (!chunks) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        return 1;
+    }
+    slab->chunks = chunks;
+    chunk = calloc(TOMO_SLAB_CHUNKLEN, slab->stride);
+    if (!chunk) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        return 1;
+    }
+    slab->chunks[slab->nchunks++] = chunk;
+    /* Push in reverse so that the lowest index is handed out first */
+    for (i = TOMO_SLAB_CHUNKLEN; i--; ) {
+        slot = (struct tomo_slot *)(chunk + i * slab->stride);
+        slot->hndl = (1U << TOMO_HANDLE_IDXBITS) | (slab->cap + i);
+        slot->next = slab->freelist;
+        slab->freelist = slab->cap + i;
+    }
+    slab->cap += TOMO_SLAB_CHUNKLEN;
+    return 0;
+}
+
+
+void *tomo_slab_alloc(TOMO_SLAB *slab, TOMO_HANDLE *hndl)
+{
+    struct tomo_slot *slot;
+
+    if (slab->count == slab->cap && tomo_slab_grow(slab)) {
+        return NULL;
+    }
+    slot = tomo_slab_slot(slab, slab->freelist);
+    slab->freelist = slot->next;
+    slab->count++;
+    *hndl = slot->hndl;
+    return slot + 1;
+}
+
+
+void *tomo_slab_get(const TOMO_SLAB *slab, TOMO_HANDLE hndl)
+{
+    const unsigned idx = hndl & TOMO_HANDLE_IDXMASK;
+    struct tomo_slot *slot;
+
+    if (idx >= slab->cap) {
+        return NULL;
+    }
+    slot = tomo_slab_slot(slab, idx);
+    return (slot->hndl == hndl) ? slot + 1 : NULL;
+}
+
+
+TOMO_HANDLE tomo_slab_handle(const void *obj)
+{
+    return ((const struct tomo_slot *)obj - 1)->hndl;
+}
+
+
+void tomo_slab_release(TOMO_SLAB *slab, TOMO_HANDLE hndl)
+{
+    const unsigned idx = hndl & TOMO_HANDLE_IDXMASK;
+    unsigned gen = (hndl >> TOMO_HANDLE_IDXBITS) + 1;
+    struct tomo_slot *slot;
+
+    slot = tomo_slab_slot(slab, idx);
+    assert(slot->hndl == hndl);
+    /* Generation zero is skipped so that TOMO_HANDLE_NONE is never issued */
+    if (gen >> (32 - TOMO_HANDLE_IDXBITS)) {
+        gen = 1;
+    }
+    slot->hndl = (gen << TOMO_HANDLE_IDXBITS) | idx;
+    slot->next = slab->freelist;
+    slab->freelist = idx;
+    slab->count--;
+}
+
+
+void tomo_slab_free(TOMO_SLAB *slab, void (*dtor)(void *obj))
+{
+    static const TOMO_SLAB zero = { 0 };
+    unsigned i;
+
+    if (dtor) {
+        for (i = 0; i < slab->cap; i++) {
+            dtor(tomo_slab_slot(slab, i) + 1);
+        }
+    }
+    for (i = 0; i < slab->nchunks; i++) {
+        free(slab->chunks[i]);
+    }
+    free(slab->chunks);
+    *slab = zero;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef TOMOSRV_SLAB_H
+#define TOMOSRV_SLAB_H
+
+#include "../defines.h"
+#include <stddef.h>
+
+
+/** Handle to a slab object. The low TOMO_HANDLE_IDXBITS bits are the slot
+ *  index, the high bits are a generation count that changes each time the slot
+ *  is released, so that stale handles stop resolving. Zero is never issued
+ */
+typedef unsigned TOMO_HANDLE;
+
+#define TOMO_HANDLE_NONE    0U
+#define TOMO_HANDLE_IDXBITS 24
+#define TOMO_HANDLE_IDXMASK ((1U << TOMO_HANDLE_IDXBITS) - 1)
+
+
+/** Number of objects carved out of each chunk */
+#define TOMO_SLAB_CHUNKLEN 64
+
+
+/** Pool of fixed-size objects. Objects never move once allocated, released
+ *  objects go on a LIFO free list, and memory is only requested from the system
+ *  in whole chunks, so steady-state allocation does not call malloc(3). Objects
+ *  from a new chunk are zero-filled; recycled objects keep whatever their
+ *  previous user left in them (e.g. buffers that can be reused)
+ */
+typedef struct tomo_slab {
+    size_t stride;      /* Bytes per slot, including its header */
+    unsigned count;     /* Live objects */
+    unsigned cap;       /* Slots in all chunks */
+    unsigned freelist;  /* First free slot, valid only if count < cap */
+
+    unsigned nchunks;
+    char   **chunks;
+} TOMO_SLAB;
+
+
+/** @brief Prepare an empty slab. No memory is allocated
+ *  @param slab
+ *      Slab
+ *  @param objsize
+ *      Size of each object
+ */
+void tomo_slab_init(TOMO_SLAB *slab, size_t objsize);
+
+
+/** @brief Allocate an object
+ *  @param slab
+ *      Slab
+ *  @param hndl
+ *      The handle of the new object is written here
+ *  @returns A pointer to the object, or NULL on error
+ */
+void *tomo_slab_alloc(TOMO_SLAB *slab, TOMO_HANDLE *hndl);
+
+
+/** @brief Resolve @p hndl
+ *  @param slab
+ *      Slab
+ *  @param hndl
+ *      Handle
+ *  @returns A pointer to the object, or NULL if @p hndl is stale or invalid
+ */
+void *tomo_slab_get(const TOMO_SLAB *slab, TOMO_HANDLE hndl);
+
+
+/** @brief Get the handle of a live object
+ *  @param obj
+ *      Pointer returned by tomo_slab_alloc or tomo_slab_get
+ *  @returns The object's handle
+ */
+TOMO_HANDLE tomo_slab_handle(const void *obj);
+
+
+/** @brief Return the object at @p hndl to the free list
+ *  @param slab
+ *      Slab
+ *  @param hndl
+ *      Handle of a live object. It, and every copy of it, becomes stale
+ */
+void tomo_slab_release(TOMO_SLAB *slab, TOMO_HANDLE hndl);
+
+
+/** @brief Free all memory held by @p slab and zero it
+ *  @param slab
+ *      Slab
+ *  @param dtor
+ *      If not NULL, this is called on every slot, live or free, before its
+ *      chunk is freed
+ */
+void tomo_slab_free(TOMO_SLAB *slab, void (*dtor)(void *obj));
+
+
+#endif /* TOMOSRV_SLAB_H */
@@ -1,310 +1,736 @@
-#include <assert.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "table.h"
-#include "../error.h"
-#include "../log.h"
-
-#include <intrin.h>
-
-/** Just let yourselves support POSIX guys, we know you don't give a fuck about
- *  ISO C anyway */
-#define strdup(s) _strdup(s)
-
-
-int tomo_mrnlist_sprint(char *buf, size_t len, const TOMO_MRNLIST *ls)
-{
-    static const wchar_t *failmsg = L"Cannot copy MRN string";
-    static const char *delim[2] = { "", "\n" };
-    const TOMO_MRNLIST *node;
-    int count, idx = 0;
-    
-    for (node = ls; node; node = node->next) {
-        count = snprintf(buf, len, "%s%s", delim[idx], ls->mrn);
-        if (count < 0) {
-            tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-            return 1;
-        } else if (count >= len) {
-            tomo_error_raise(TOMO_ERROR_USER, L"Truncation occurred", failmsg);
-            return 1;
-        }
-        buf += count;
-        len -= count;
-        idx |= 1;
-    }
-    return 0;
-}
-
-
-/** @brief Extremely basic universal string hash function */
-static unsigned tomohash(const char *key)
-{
-    const unsigned prime = 17;
-    unsigned pow = 1, res = 0;
-
-    for (; *key; key++) {
-        res += pow * *key;
-        pow *= prime;
-    }
-    return res;
-}
-
-
-/** @brief Modulo with the table size, made trivial by the invariant that
- *      tbl->len % 2 == 0
- */
-static unsigned tomomod(const TOMO_MRNTABLE *tbl, unsigned hash)
-{
-    return hash & (tbl->len - 1);
-}
-
-
-/** @brief Rounds @p x up to the next highest power of two, using ancient two's
- *      complement bit-twiddling techniques. I fetched/adapted this code from
- *      one of the bajillion answers of its kind on good old Stack Overflow
- *  @param x
- *      Value to round up
- *  @returns The first power of two not less than @p x (could be equal to x!)
- */
-static unsigned next_pow2(unsigned x)
-{
-    const size_t width = sizeof x;
-
-    x--;
-    switch (width) {
-    case 8:
-        x |= x >> 32;
-    case 4:
-        x |= x >> 16;
-    case 2:
-        x |= x >> 8;
-    case 1:
-        x |= x >> 4;
-        x |= x >> 2;
-        x |= x >> 1;
-    }
-    return x + 1;
-}
-
-
-/** @brief Find @p key in @p tbl
- *  @param tbl
- *      Table
- *  @param key
- *      Key string
- *  @returns A pointer to the containing bucket, or the first empty bucket where
- *      it should be placed
- */
-static TOMO_MRNPAIR *tomo_mrntable_find(TOMO_MRNTABLE *tbl,
-                                        const char    *key)
-{
-    unsigned hash;
-
-    hash = tomomod(tbl, tomohash(key));
-    while (tbl->table[hash].key) {
-        if (!strcmp(tbl->table[hash].key, key)) {
-            break;
-        }
-        hash = tomomod(tbl, hash + 1);
-    }
-    return &tbl->table[hash];
-}
-
-
-static int tomo_strcpy(char *dst, size_t len, const char *str)
-{
-    static const wchar_t *failmsg = L"Cannot copy string";
-    int count;
-
-    count = snprintf(dst, len, "%s", str);
-    if (count < 0) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
-        return 1;
-    } else if ((size_t)count >= len) {
-        tomo_error_raise(TOMO_ERROR_USER, L"Buffer overrun", failmsg);
-        return 1;
-    }
-    return 0;
-}
-
-
-/** @brief Insert @p val into the MRN list at @p head
- *  @param head
- *      Pointer to head pointer
- *  @param val
- *      Value string to insert
- *  @returns Negative on error, zero on success, and positive if @p val was
- *      already in the list
- */
-static int tomo_mrnlist_insert(TOMO_MRNLIST **head, const char *val)
-{
-    static const wchar_t *buffail = L"Failed copying MRN string";
-
-    while (*head) {
-        if (!strcmp((*head)->mrn, val)) {
-            return 1;
-        }
-        head = &(*head)->next;
-    }
-    *head = calloc(1UL, sizeof **head);
-    if (!*head) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed allocating MRN list node");
-        return -1;
-    }
-    if (tomo_strcpy((*head)->mrn, BUFLEN((*head)->mrn), val)) {
-        tomo_error_set_ctx(buffail);
-        return -1;
-    }
-    return 0;
-}
-
-
-/** @brief Inserts @p key, @p val into the list at @p pair
- *  @param pair
- *      Hash bucket
- *  @param key
- *      Key string
- *  @param val
- *      Value string
- *  @returns Negative on error, zero on success, and one if @p val was already
- *      in the list
- */
-static int tomo_mrnpair_insert(TOMO_MRNPAIR *pair,
-                               const char   *key,
-                               const char   *val)
-{
-    if (!pair->key) {
-        pair->key = strdup(key);
-        if (!pair->key) {
-            tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed allocating MRN list key");
-            return -1;
-        }
-    }
-    return tomo_mrnlist_insert(&pair->val, val);
-}
-
-
-/** @brief Checks the load factor ratio to the table capacity
- *  @param tbl
- *      Hash table
- *  @returns true if the table should be reallocated
- */
-static bool tomo_mrntable_overload(const TOMO_MRNTABLE *tbl)
-{
-    /* The load limit is this proportion of table capacity */
-    const unsigned num = 2, denom = 3;
-    const unsigned lim = (num * tbl->len) / denom;
-
-    return tbl->load >= lim;
-}
-
-
-/** @brief Change the capacity of @p tbl
- *  @param tbl
- *      Hash table
- *  @param newlen
- *      New length of the hash table. This should be larger than the current
- *      length, and a power of two
- *  @returns Nonzero on error
- *  @warning This function is not designed to reduce the capacity, and you will
- *      very likely end up leaking string buffers if you attempt to do so!
- */
-static int tomo_mrntable_realloc(TOMO_MRNTABLE *tbl, unsigned newlen)
-{
-    TOMO_MRNTABLE next = {
-        .len = newlen,
-        .load = tbl->load
-    };
-    TOMO_MRNPAIR *pair;
-    unsigned i;
-
-    assert(newlen > tbl->len);
-    assert(__popcnt(newlen) == 1);
-    next.table = calloc(next.len, sizeof *next.table);
-    if (!next.table) {
-        tomo_error_raise(TOMO_ERROR_SYS, NULL, L"Failed reallocating MRN table");
-        return 1;
-    }
-    /* Move the KV pairs. Insert should not be used here because it copies data */
-    for (i = 0; i < tbl->len; i++) {
-        if (tbl->table[i].key) {
-            pair = tomo_mrntable_find(&next, tbl->table[i].key);
-            assert(!pair->key);
-            *pair = tbl->table[i];
-        }
-    }
-    free(tbl->table);
-    *tbl = next;
-    return 0;
-}
-
-
-int tomo_mrntable_init(TOMO_MRNTABLE *tbl, unsigned minsize)
-{
-    unsigned len;
-
-    len = next_pow2(minsize);
-    tomo_mrntable_free(tbl);
-    return tomo_mrntable_realloc(tbl, len);
-}
-
-
-int tomo_mrntable_insert(TOMO_MRNTABLE *tbl, const char *key, const char *val)
-{
-    TOMO_MRNPAIR *pair;
-    int res;
-
-    pair = tomo_mrntable_find(tbl, key);
-    res = tomo_mrnpair_insert(pair, key, val);
-    if (res < 0) {
-        return 1;
-    } else if (!res) {
-        tbl->load++;
-        if (tomo_mrntable_overload(tbl)) {
-            if (tomo_mrntable_realloc(tbl, tbl->len * 2)) {
-                return -1;
-            }
-        }
-        return 0;
-    } else {
-        return 1;
-    }
-}
-
-
-const TOMO_MRNPAIR *tomo_mrntable_lookup(TOMO_MRNTABLE *tbl, const char *key)
-{
-    TOMO_MRNPAIR *pair;
-
-    pair = tomo_mrntable_find(tbl, key);
-    return (pair->key) ? pair : NULL;
-}
-
-
-static void tomo_mrnlist_free(TOMO_MRNLIST *ls)
-{
-    TOMO_MRNLIST *next;
-
-    for (; ls; ls = next) {
-        next = ls->next;
-        free(ls);
-    }
-}
-
-
-void tomo_mrntable_free(TOMO_MRNTABLE *tbl)
-{
-    static const TOMO_MRNTABLE zero = { 0 };
-    unsigned i;
-
-    for (i = 0; i < tbl->len; i++) {
-        if (tbl->table[i].key) {
-            free(tbl->table[i].key);
-            tomo_mrnlist_free(tbl->table[i].val);
-        }
-    }
-    free(tbl->table);
-    *tbl = zero;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+#include "hash.h"
+#include "../error.h"
+#include "../log.h"
+
+/* Instantiate the name index declared in table.h */
+#define TOMO_MAP_NAME      tomo_mrnmap
+#define TOMO_MAP_TYPE      TOMO_MRNMAP
+#define TOMO_MAP_ENTRY     TOMO_MRNPAIR
+#define TOMO_MAP_KEY       char *
+#define TOMO_MAP_VAL       TOMO_MRNVALS
+#define TOMO_MAP_KEYARG    const char *
+#define TOMO_MAP_HASH(k)   tomo_hash((k), strlen(k))
+#define TOMO_MAP_EQ(s, k)  (!strcmp((s), (k)))
+#define TOMO_MAP_PREFETCH(e) tomo_prefetch((e)->key)
+#define TOMO_MAP_IMPLEMENT
+#include "map.h"
+
+
+/** @brief Check whether @p mrn is packed BCD rather than a string pointer */
+static bool tomo_mrn_packed(const TOMO_MRN *mrn)
+{
+    return mrn->bcd[0] & 1;
+}
+
+
+/** @brief Pack @p val into @p mrn if it is all digits and short enough
+ *  @param mrn
+ *      Destination
+ *  @param val
+ *      MRN string
+ *  @returns true if @p val was packed
+ */
+static bool tomo_mrn_pack(TOMO_MRN *mrn, const char *val)
+{
+    const size_t len = strlen(val);
+    unsigned char digit;
+    size_t i;
+
+    if (!len || len > TOMO_MRN_BCDMAX) {
+        return false;
+    }
+    mrn->bits = 0;
+    mrn->bcd[0] = (unsigned char)((len << 1) | 1);
+    for (i = 0; i < len; i++) {
+        digit = (unsigned char)(val[i] - '0');
+        if (digit > 9) {
+            return false;
+        }
+        mrn->bcd[1 + i / 2] |= (i & 1) ? digit : digit << 4;
+    }
+    return true;
+}
+
+
+/** @brief Get the string form of @p mrn
+ *  @param mrn
+ *      MRN
+ *  @param buf
+ *      Scratch space for unpacking BCD
+ *  @returns @p buf, or the MRN's own string
+ */
+static const char *tomo_mrn_str(const TOMO_MRN *mrn, char buf[TOMO_MRN_BCDMAX + 1])
+{
+    size_t i, len;
+
+    if (!tomo_mrn_packed(mrn)) {
+        return mrn->str;
+    }
+    len = mrn->bcd[0] >> 1;
+    for (i = 0; i < len; i++) {
+        buf[i] = '0' + ((i & 1) ? mrn->bcd[1 + i / 2] & 0xF : mrn->bcd[1 + i / 2] >> 4);
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+
+/** @brief Get the array of MRNs in @p vals, wherever it is */
+static TOMO_MRN *tomo_mrnvals_data(const TOMO_MRNVALS *vals)
+{
+    return (vals->count > TOMO_MRN_INLINE) ? vals->spill : (TOMO_MRN *)vals->inl;
+}
+
+
+/** @brief Build the block holding @p key followed by the reply for the MRNs of
+ *      @p pair, and point @p pair at it
+ *  @param arena
+ *      Arena to allocate the block from
+ *  @param pair
+ *      Hash bucket, with at least one MRN
+ *  @param key
+ *      Key string
+ *  @returns Nonzero on error, in which case @p pair is unchanged
+ */
+static int tomo_mrnpair_render(TOMO_ARENA   *arena,
+                               TOMO_MRNPAIR *pair,
+                               const char   *key)
+{
+    TOMO_MRNVALS *const vals = &pair->val;
+    const TOMO_MRN *mrn = tomo_mrnvals_data(vals);
+    const size_t keylen = strlen(key) + 1;
+    char digits[TOMO_MRN_BCDMAX + 1];
+    char *block, *dst;
+    const char *str;
+    size_t len, n;
+    unsigned i;
+
+    /* Key, then every MRN and its newline, then the empty line and a nul */
+    len = keylen + 2;
+    for (i = 0; i < vals->count; i++) {
+        len += strlen(tomo_mrn_str(&mrn[i], digits)) + 1;
+    }
+    block = tomo_arena_alloc(arena, len, 1);
+    if (!block) {
+        tomo_error_set_ctx(L"Failed allocating MRN reply");
+        return 1;
+    }
+    memcpy(block, key, keylen);
+    dst = block + keylen;
+    for (i = 0; i < vals->count; i++) {
+        str = tomo_mrn_str(&mrn[i], digits);
+        n = strlen(str);
+        memcpy(dst, str, n);
+        dst += n;
+        *dst++ = '\n';
+    }
+    *dst++ = '\n';
+    *dst = '\0';
+    pair->key = block;
+    vals->keylen = (unsigned)(keylen - 1);
+    vals->replylen = (unsigned)(dst - block - keylen);
+    return 0;
+}
+
+
+/** @brief Insert @p val into the MRNs at @p vals
+ *  @param arena
+ *      Arena for MRN strings and spilled arrays
+ *  @param vals
+ *      MRNs
+ *  @param val
+ *      Value string to insert
+ *  @returns Negative on error, zero on success, and positive if @p val was
+ *      already listed
+ */
+static int tomo_mrnvals_insert(TOMO_ARENA   *arena,
+                               TOMO_MRNVALS *vals,
+                               const char   *val)
+{
+    static const wchar_t *failmsg = L"Failed allocating MRN storage";
+    TOMO_MRN mrn, *data = tomo_mrnvals_data(vals), *spill;
+    const bool packed = tomo_mrn_pack(&mrn, val);
+    unsigned i, cap;
+    size_t len;
+    char *str;
+
+    /* Packing is canonical, so a packed MRN only ever equals a packed MRN */
+    for (i = 0; i < vals->count; i++) {
+        if (packed) {
+            if (data[i].bits == mrn.bits) {
+                return 1;
+            }
+        } else if (!tomo_mrn_packed(&data[i]) && !strcmp(data[i].str, val)) {
+            return 1;
+        }
+    }
+    if (!packed) {
+        len = strlen(val) + 1;
+        str = tomo_arena_alloc(arena, len, 2);
+        if (!str) {
+            tomo_error_set_ctx(failmsg);
+            return -1;
+        }
+        memcpy(str, val, len);
+        mrn.bits = 0;
+        mrn.str = str;
+    }
+    if (vals->count < TOMO_MRN_INLINE) {
+        vals->inl[vals->count++] = mrn;
+        return 0;
+    }
+    if (vals->count == TOMO_MRN_INLINE || vals->count == vals->cap) {
+        /* The old array stays behind in the arena, but duplicates are rare */
+        cap = vals->count * 2;
+        spill = tomo_arena_alloc(arena, cap * sizeof *spill, sizeof *spill);
+        if (!spill) {
+            tomo_error_set_ctx(failmsg);
+            return -1;
+        }
+        memcpy(spill, data, vals->count * sizeof *spill);
+        vals->spill = spill;
+        vals->cap = cap;
+    }
+    vals->spill[vals->count++] = mrn;
+    return 0;
+}
+
+
+/** @brief Inserts @p key, @p val into the bucket at @p pair, and renders its
+ *      reply again if @p val is new
+ *  @param arena
+ *      Arena to copy strings into
+ *  @param pair
+ *      Hash bucket
+ *  @param key
+ *      Key string
+ *  @param val
+ *      Value string
+ *  @returns Negative on error, zero on success, and one if @p val was already
+ *      listed
+ */
+static int tomo_mrnpair_insert(TOMO_ARENA   *arena,
+                               TOMO_MRNPAIR *pair,
+                               const char   *key,
+                               const char   *val)
+{
+    int res;
+
+    res = tomo_mrnvals_insert(arena, &pair->val, val);
+    if (!res) {
+        /* A previous block is left behind, but only names with several MRNs
+        are rendered more than once */
+        if (tomo_mrnpair_render(arena, pair, key)) {
+            return -1;
+        }
+    }
+    return res;
+}
+
+
+/** Mean number of keys per perfect hash bucket. Bigger buckets mean fewer
+ *  pilots to store, but a longer pilot search for each
+ */
+#define TOMO_FROZEN_LAMBDA 5
+
+/** Keys per slot the perfect hash is built for, in percent. The few slots past
+ *  the last key are remapped onto the holes below it, so the frozen table ends
+ *  up exactly full
+ */
+#define TOMO_FROZEN_ALPHA 99
+
+/** Pilots tried per bucket before giving up. Only keys with equal 64-bit
+ *  hashes should ever get near this
+ */
+#define TOMO_FROZEN_MAXPILOT (1U << 20)
+
+
+/** A key being placed by tomo_mrntable_freeze() */
+typedef struct tomo_frozen_key {
+    unsigned long long hash;
+    unsigned src;   /* Bucket in the dynamic table */
+    unsigned pos;   /* Slot the pilot sends it to, which may be past the end */
+} TOMO_FROZEN_KEY;
+
+
+/** @brief Hash a key string for the frozen layout */
+static unsigned long long tomo_frozen_hash(const char *key)
+{
+    return tomo_hash64(key, strlen(key));
+}
+
+
+/** @brief Get the perfect hash bucket of @p hash, out of @p nbuckets */
+static unsigned tomo_frozen_bucket(unsigned nbuckets, unsigned long long hash)
+{
+    /* Scale the low half into range with a multiply rather than a divide */
+    return (unsigned)(((hash & 0xFFFFFFFF) * nbuckets) >> 32);
+}
+
+
+/** @brief Get the slot in [0, @p range) that @p pilot sends @p hash to */
+static unsigned tomo_frozen_pos(unsigned long long hash,
+                                unsigned           pilot,
+                                unsigned           range)
+{
+    unsigned long long x = hash ^ (pilot * 0x9E3779B97F4A7C15ULL);
+
+    /* splitmix64 finalizer, so that every pilot is a fresh hash function */
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (unsigned)(((x >> 32) * range) >> 32);
+}
+
+
+/** @brief Get the slot of the key hashing to @p hash in frozen @p tbl */
+static unsigned tomo_frozen_slot(const TOMO_MRNTABLE *tbl,
+                                 unsigned long long   hash)
+{
+    const unsigned pilot = tbl->pilots[tomo_frozen_bucket(tbl->nbuckets, hash)];
+    const unsigned pos = tomo_frozen_pos(hash, pilot, tbl->range);
+
+    return (pos < tbl->map.load) ? pos
+                                 : tbl->pilots[tbl->nbuckets + pos - tbl->map.load];
+}
+
+
+/** @brief Check bit @p idx of @p bits */
+static bool tomo_bit_test(const unsigned long long *bits, unsigned idx)
+{
+    return (bits[idx >> 6] >> (idx & 63)) & 1;
+}
+
+
+/** @brief Search a pilot for every perfect hash bucket, largest buckets first,
+ *      such that all of the bucket's keys land in distinct free slots
+ *  @param keys
+ *      Keys, grouped by bucket. The slot of each is written to its pos
+ *  @param start
+ *      Offset of the first key of each bucket, plus the total key count
+ *  @param nbuckets
+ *      Number of buckets
+ *  @param range
+ *      Number of slots
+ *  @param pilots
+ *      The pilot of each bucket is written here
+ *  @param taken
+ *      Zeroed bitmap of @p range bits, the taken slots are set
+ *  @returns Nonzero on error
+ */
+static int tomo_frozen_search(TOMO_FROZEN_KEY     *keys,
+                              const unsigned      *start,
+                              unsigned             nbuckets,
+                              unsigned             range,
+                              unsigned            *pilots,
+                              unsigned long long  *taken)
+{
+    static const wchar_t *failmsg = L"Failed building perfect hash";
+    unsigned *order, *count;
+    unsigned i, j, k, b, size, first, off, tmp, pilot, maxsize = 0;
+    int res = 0;
+
+    for (b = 0; b < nbuckets; b++) {
+        size = start[b + 1] - start[b];
+        maxsize = (size > maxsize) ? size : maxsize;
+    }
+    count = calloc(maxsize + 1, sizeof *count);
+    order = malloc(nbuckets * sizeof *order);
+    if (!count || !order) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+        free(count);
+        free(order);
+        return 1;
+    }
+    /* Counting sort of the buckets by size, descending */
+    for (b = 0; b < nbuckets; b++) {
+        count[start[b + 1] - start[b]]++;
+    }
+    for (off = 0, size = maxsize + 1; size--; off += tmp) {
+        tmp = count[size];
+        count[size] = off;
+    }
+    for (b = 0; b < nbuckets; b++) {
+        order[count[start[b + 1] - start[b]]++] = b;
+    }
+    for (i = 0; i < nbuckets; i++) {
+        b = order[i];
+        first = start[b];
+        size = start[b + 1] - first;
+        if (!size) {
+            break;
+        }
+        for (pilot = 0; pilot < TOMO_FROZEN_MAXPILOT; pilot++) {
+            for (j = 0; j < size; j++) {
+                keys[first + j].pos = tomo_frozen_pos(keys[first + j].hash, pilot, range);
+                if (tomo_bit_test(taken, keys[first + j].pos)) {
+                    break;
+                }
+                for (k = 0; k < j && keys[first + k].pos != keys[first + j].pos; k++);
+                if (k < j) {
+                    break;
+                }
+            }
+            if (j == size) {
+                break;
+            }
+        }
+        if (pilot == TOMO_FROZEN_MAXPILOT) {
+            tomo_error_raise(TOMO_ERROR_USER, L"Keys with equal 64-bit hashes", failmsg);
+            res = 1;
+            break;
+        }
+        pilots[b] = pilot;
+        for (j = 0; j < size; j++) {
+            taken[keys[first + j].pos >> 6] |= 1ULL << (keys[first + j].pos & 63);
+        }
+    }
+    free(count);
+    free(order);
+    return res;
+}
+
+
+int tomo_mrntable_init(TOMO_MRNTABLE *tbl, unsigned minsize)
+{
+    tomo_mrntable_free(tbl);
+    return tomo_mrnmap_init(&tbl->map, minsize);
+}
+
+
+int tomo_mrntable_reserve(TOMO_MRNTABLE *tbl, unsigned count)
+{
+    if (tbl->pilots) {
+        return 0;
+    }
+    return tomo_mrnmap_reserve(&tbl->map, count);
+}
+
+
+int tomo_mrntable_insert(TOMO_MRNTABLE *tbl, const char *key, const char *val)
+{
+    const unsigned long long hash = tomo_mrnmap_hash(key);
+    TOMO_MRNPAIR *pair, fresh = { 0 };
+    int res;
+
+    if (tbl->pilots) {
+        tomo_error_raise(TOMO_ERROR_USER, L"Table is frozen", L"Cannot insert into MRN table");
+        return -1;
+    }
+    pair = tomo_mrnmap_get(&tbl->map, key, hash);
+    if (pair) {
+        return tomo_mrnpair_insert(&tbl->arena, pair, key, val);
+    }
+    /* A new entry is built on the side, and only added once it is whole.
+    On failure anything already copied to the arena is simply wasted */
+    res = tomo_mrnpair_insert(&tbl->arena, &fresh, key, val);
+    if (res < 0 || tomo_mrnmap_add(&tbl->map, fresh, hash, false)) {
+        return -1;
+    }
+    return res;
+}
+
+
+int tomo_mrntable_remove(TOMO_MRNTABLE *tbl, const char *key)
+{
+    if (tbl->pilots) {
+        tomo_error_raise(TOMO_ERROR_USER, L"Table is frozen", L"Cannot remove from MRN table");
+        return -1;
+    }
+    return tomo_mrnmap_remove(&tbl->map, key, tomo_mrnmap_hash(key)) ? 1 : 0;
+}
+
+
+int tomo_mrntable_replace(TOMO_MRNTABLE     *tbl,
+                          const char        *key,
+                          const char *const *vals,
+                          unsigned           count)
+{
+    const unsigned long long hash = tomo_mrnmap_hash(key);
+    TOMO_MRNPAIR *pair, fresh = { 0 };
+    unsigned i;
+
+    if (!count) {
+        return tomo_mrntable_remove(tbl, key) < 0;
+    }
+    if (tbl->pilots) {
+        tomo_error_raise(TOMO_ERROR_USER, L"Table is frozen", L"Cannot replace in MRN table");
+        return 1;
+    }
+    /* The new list is built on the side and only swapped in once it is
+    whole, so a failure leaves the old MRNs listed */
+    for (i = 0; i < count; i++) {
+        if (tomo_mrnvals_insert(&tbl->arena, &fresh.val, vals[i]) < 0) {
+            return 1;
+        }
+    }
+    if (tomo_mrnpair_render(&tbl->arena, &fresh, key)) {
+        return 1;
+    }
+    pair = tomo_mrnmap_get(&tbl->map, key, hash);
+    if (pair) {
+        *pair = fresh;
+        return 0;
+    }
+    /* Lookups may be waiting on this, so growing is spread over the adds
+    and removes that follow */
+    return tomo_mrnmap_add(&tbl->map, fresh, hash, true);
+}
+
+
+/** Buckets tomo_mrntable_merge() looks ahead of the one it is moving */
+#define TOMO_MRNTABLE_AHEAD 16
+
+
+int tomo_mrntable_merge(TOMO_MRNTABLE *dst, TOMO_MRNTABLE *src)
+{
+    TOMO_MRNMAP *const map = &src->map;
+    char digits[TOMO_MRN_BCDMAX + 1];
+    const TOMO_MRNPAIR *from;
+    const TOMO_MRN *mrn;
+    TOMO_MRNPAIR *pair;
+    unsigned i, j, home;
+    int res = 0;
+
+    if (dst->pilots || src->pilots) {
+        tomo_error_raise(TOMO_ERROR_USER, L"Table is frozen", L"Cannot merge MRN tables");
+        tomo_mrntable_free(src);
+        return 1;
+    }
+    /* Only the new arrays are walked below */
+    tomo_mrnmap_migrate(map, UINT_MAX);
+    tomo_arena_splice(&dst->arena, &src->arena);
+    res = tomo_mrnmap_reserve(&dst->map, dst->map.load + map->load);
+    for (i = 0; !res && i < map->len; i++) {
+        if (map->ctrl[i] == TOMO_CTRL_EMPTY) {
+            continue;
+        }
+        /* Both tables hash with the same function, so the stored hash is
+        good for dst too, and says where to prefetch further ahead */
+        if (i + TOMO_MRNTABLE_AHEAD < map->len) {
+            home = tomo_mrnmap_mod(&dst->map, tomo_map_home(map->hashes[i + TOMO_MRNTABLE_AHEAD]));
+            tomo_prefetch(&dst->map.ctrl[home]);
+            tomo_prefetch(&dst->map.table[home]);
+        }
+        from = &map->table[i];
+        pair = tomo_mrnmap_get(&dst->map, from->key, map->hashes[i]);
+        if (!pair) {
+            res = tomo_mrnmap_add(&dst->map, *from, map->hashes[i], false);
+            continue;
+        }
+        mrn = tomo_mrnvals_data(&from->val);
+        for (j = 0; !res && j < from->val.count; j++) {
+            res = tomo_mrnpair_insert(&dst->arena, pair, from->key,
+                                      tomo_mrn_str(&mrn[j], digits)) < 0;
+        }
+    }
+    tomo_mrntable_free(src);
+    return res;
+}
+
+
+int tomo_mrntable_freeze(TOMO_MRNTABLE *tbl)
+{
+    static const wchar_t *failmsg = L"Failed freezing MRN table";
+    TOMO_MRNMAP *const map = &tbl->map;
+    const unsigned n = map->load;
+    const unsigned nbuckets = n / TOMO_FROZEN_LAMBDA + 1;
+    const unsigned range = (unsigned)((unsigned long long)n * 100 / TOMO_FROZEN_ALPHA) + 1;
+    TOMO_FROZEN_KEY *keys, *sorted;
+    unsigned *start, *pilots, *remap;
+    unsigned long long *taken;
+    TOMO_MRNPAIR *slots;
+    unsigned i, j, b, pos, hole;
+    int res = 1;
+
+    if (tbl->pilots || !n) {
+        return 0;
+    }
+    /* The slots are filled from the new arrays alone */
+    tomo_mrnmap_migrate(map, UINT_MAX);
+    keys = malloc(2ULL * n * sizeof *keys);
+    start = calloc(nbuckets + 1ULL, sizeof *start);
+    pilots = calloc((unsigned long long)nbuckets + range - n, sizeof *pilots);
+    taken = calloc(range / 64 + 1ULL, sizeof *taken);
+    slots = malloc((unsigned long long)n * sizeof *slots);
+    if (!keys || !start || !pilots || !taken || !slots) {
+        tomo_error_raise(TOMO_ERROR_SYS, NULL, failmsg);
+    } else {
+        /* Group the keys by bucket: count, turn the counts into bucket ends,
+        then fill each bucket back to front, which leaves start[b] at its
+        beginning */
+        sorted = keys + n;
+        for (i = j = 0; i < map->len; i++) {
+            if (map->ctrl[i] != TOMO_CTRL_EMPTY) {
+                keys[j].hash = tomo_frozen_hash(map->table[i].key);
+                keys[j].src = i;
+                start[tomo_frozen_bucket(nbuckets, keys[j].hash)]++;
+                j++;
+            }
+        }
+        for (b = 1; b < nbuckets; b++) {
+            start[b] += start[b - 1];
+        }
+        start[nbuckets] = n;
+        for (j = n; j--;) {
+            b = tomo_frozen_bucket(nbuckets, keys[j].hash);
+            sorted[--start[b]] = keys[j];
+        }
+        res = tomo_frozen_search(sorted, start, nbuckets, range, pilots, taken);
+    }
+    if (!res) {
+        /* Every slot taken past the last key pairs up with a hole below it */
+        remap = pilots + nbuckets;
+        for (pos = n, hole = 0; pos < range; pos++) {
+            if (tomo_bit_test(taken, pos)) {
+                while (tomo_bit_test(taken, hole)) {
+                    hole++;
+                }
+                remap[pos - n] = hole++;
+            }
+        }
+        for (j = 0; j < n; j++) {
+            pos = sorted[j].pos;
+            slots[(pos < n) ? pos : remap[pos - n]] = map->table[sorted[j].src];
+        }
+        free(map->table);
+        map->table = slots;
+        map->hashes = NULL;
+        map->ctrl = NULL;
+        map->len = n;
+        tbl->pilots = pilots;
+        tbl->nbuckets = nbuckets;
+        tbl->range = range;
+        slots = NULL;
+        pilots = NULL;
+    }
+    free(keys);
+    free(start);
+    free(pilots);
+    free(taken);
+    free(slots);
+    return res;
+}
+
+
+const TOMO_MRNPAIR *tomo_mrntable_lookup(TOMO_MRNTABLE *tbl, const char *key)
+{
+    const TOMO_MRNPAIR *pair;
+
+    if (tbl->pilots) {
+        pair = &tbl->map.table[tomo_frozen_slot(tbl, tomo_frozen_hash(key))];
+        return (!strcmp(pair->key, key)) ? pair : NULL;
+    }
+    return tomo_mrnmap_get(&tbl->map, key, tomo_mrnmap_hash(key));
+}
+
+
+/** @brief tomo_mrntable_lookup_many() for a frozen table. A lookup touches
+ *      a pilot, a slot and a key, in that order, so each gets its own pass
+ */
+static void tomo_frozen_lookup_many(const TOMO_MRNTABLE *tbl,
+                                    const char *const   *keys,
+                                    size_t               count,
+                                    const TOMO_MRNPAIR **pairs)
+{
+    unsigned long long hash[TOMO_MRNTABLE_BATCH];
+    unsigned slot[TOMO_MRNTABLE_BATCH];
+    size_t i, n;
+
+    for (; count; keys += n, pairs += n, count -= n) {
+        n = (count < TOMO_MRNTABLE_BATCH) ? count : TOMO_MRNTABLE_BATCH;
+        for (i = 0; i < n; i++) {
+            hash[i] = tomo_frozen_hash(keys[i]);
+            tomo_prefetch(&tbl->pilots[tomo_frozen_bucket(tbl->nbuckets, hash[i])]);
+        }
+        for (i = 0; i < n; i++) {
+            slot[i] = tomo_frozen_slot(tbl, hash[i]);
+            tomo_prefetch(&tbl->map.table[slot[i]]);
+        }
+        for (i = 0; i < n; i++) {
+            tomo_prefetch(tbl->map.table[slot[i]].key);
+        }
+        for (i = 0; i < n; i++) {
+            pairs[i] = (!strcmp(tbl->map.table[slot[i]].key, keys[i]))
+                     ? &tbl->map.table[slot[i]] : NULL;
+        }
+    }
+}
+
+
+void tomo_mrntable_lookup_many(TOMO_MRNTABLE       *tbl,
+                               const char *const   *keys,
+                               size_t               count,
+                               const TOMO_MRNPAIR **pairs)
+{
+    if (tbl->pilots) {
+        tomo_frozen_lookup_many(tbl, keys, count, pairs);
+    } else {
+        tomo_mrnmap_get_many(&tbl->map, keys, count, pairs);
+    }
+}
+
+
+/** Probe histogram classes: displacement 0, then [2^(i-1), 2^i) for class i */
+#define TOMO_PROBE_CLASSES 24
+
+
+void tomo_mrntable_log_probes(const TOMO_MRNTABLE *tbl, TOMO_LOGLVL lvl)
+{
+    unsigned hist[TOMO_PROBE_CLASSES] = { 0 };
+    unsigned long long groups = 0;
+    unsigned i, disp, maxdisp = 0, cls, lo, hi, hits = 0;
+    const TOMO_MRNMAP *const map = &tbl->map;
+    unsigned long bit;
+
+    if (tbl->pilots) {
+        tomo_logf(lvl, L"MRN table: %u keys frozen into as many slots (%u perfect hash buckets over %u slots), %.2f bits per key",
+                  map->load, tbl->nbuckets, tbl->range,
+                  32.0 * (tbl->nbuckets + tbl->range - map->load) / map->load);
+        return;
+    }
+    for (i = 0; i < map->len; i++) {
+        if (map->ctrl[i] == TOMO_CTRL_EMPTY) {
+            continue;
+        }
+        disp = tomo_mrnmap_dist(map, i);
+        cls = (_BitScanReverse(&bit, disp)) ? bit + 1 : 0;
+        hist[(cls < TOMO_PROBE_CLASSES) ? cls : TOMO_PROBE_CLASSES - 1]++;
+        groups += disp / TOMO_MAP_GROUP + 1;
+        hits++;
+        if (disp > maxdisp) {
+            maxdisp = disp;
+        }
+    }
+    tomo_logf(lvl, L"MRN table: %u keys in %u buckets (%s hash), %.3f groups per hit, max displacement %u",
+              map->load, map->len, tomo_hash_name(),
+              (hits) ? (double)groups / hits : 0.0, maxdisp);
+    if (map->old.table) {
+        /* Those are left out of the figures above */
+        tomo_logf(lvl, L"  growing incrementally: %u keys still in the old %u buckets",
+                  map->old.load, map->old.len);
+    }
+    for (cls = 0; cls < TOMO_PROBE_CLASSES; cls++) {
+        if (hist[cls]) {
+            lo = (cls) ? 1U << (cls - 1) : 0;
+            hi = (cls) ? (1U << cls) - 1 : 0;
+            tomo_logf(lvl, L"  displacement %u-%u: %u keys", lo, hi, hist[cls]);
+        }
+    }
+}
+
+
+void tomo_mrntable_free(TOMO_MRNTABLE *tbl)
+{
+    static const TOMO_MRNTABLE zero = { 0 };
+
+    tomo_arena_free(&tbl->arena);
+    tomo_mrnmap_free(&tbl->map);
+    free(tbl->pilots);
+    *tbl = zero;
+}
@@ -1,88 +1,252 @@
-#pragma once
-
-#ifndef TOMOSRV_TABLE_H
-#define TOMOSRV_TABLE_H
-
-#include "../defines.h"
-
-
-typedef struct tomo_mrnlist {
-    struct tomo_mrnlist *next;
-
-    char mrn[16];   /* Truncation of this field will result in an app ERROR */
-} TOMO_MRNLIST;
-
-
-/** @brief Print @p ls to @p buf
- *  @param buf
- *      Buffer
- *  @param len
- *      Buffer count
- *  @param ls
- *      MRN list
- *  @returns Nonzero on error (truncation)
- */
-int tomo_mrnlist_sprint(char *buf, size_t len, const TOMO_MRNLIST *ls);
-
-
-typedef struct tomo_mrnpair {
-    char         *key;
-    TOMO_MRNLIST *val;
-} TOMO_MRNPAIR;
-
-
-/** Insert-only hash table for strings keyed to strings. Strings are stored
- *  in heap buffers
- */
-typedef struct tomo_mrntable {
-    unsigned len, load;
-    TOMO_MRNPAIR *table;
-} TOMO_MRNTABLE;
-
-
-/** @brief Initialize @p tbl to at least @p minsize capacity. This function is
- *      safe to call on an initialized table: It will free the table and
- *      reinitialize it
- *  @param tbl
- *      Hash table
- *  @param minsize
- *      Minimum initial size. This is rounded up to the first power of two not
- *      less than its value. If it is a power of two, it is unchanged
- *  @returns Nonzero on error
- */
-int tomo_mrntable_init(TOMO_MRNTABLE *tbl, unsigned minsize);
-
-
-/** @brief Insert @p key, @p val into @p tbl
- *  @param tbl
- *      Hash table
- *  @param key
- *      Key string. This is copied into a heap buffer
- *  @param val
- *      Value string. This is also copied into a heap buffer
- *  @returns Negative on failure, 0 on success, and positive if @p key is
- *      already in the table. If @p key already exists, it is *not* overwritten
- */
-int tomo_mrntable_insert(TOMO_MRNTABLE *tbl, const char *key, const char *val);
-
-
-/** @brief Look up @p key in @p tbl
- *  @param tbl
- *      MRN table
- *  @param key
- *      Key to look up
- *  @returns A pointer to the value list associated with @p key, or NULL if
- *      not found
- */
-const TOMO_MRNPAIR *tomo_mrntable_lookup(TOMO_MRNTABLE *tbl, const char *key);
-
-
-/** @brief Frees memory held by @p tbl
- *  @param tbl
- *      MRN table. The memory for this object is externally managed, but its
- *      contents will be cleared by this call
- */
-void tomo_mrntable_free(TOMO_MRNTABLE *tbl);
-
-
-#endif /* TOMOSRV_TABLE_H */
+#pragma once
+
+#ifndef TOMOSRV_TABLE_H
+#define TOMOSRV_TABLE_H
+
+#include "../defines.h"
+#include "../log.h"
+#include "arena.h"
+
+
+/** Longest all-digit MRN that is packed as BCD */
+#define TOMO_MRN_BCDMAX 14
+
+/** Number of MRNs a bucket holds before spilling to an array */
+#define TOMO_MRN_INLINE 2
+
+
+/** One MRN in eight bytes. An all-digit MRN of up to TOMO_MRN_BCDMAX digits is
+ *  packed as BCD: the first byte holds the digit count shifted up by one with
+ *  the low bit set, followed by two digits per byte. Any other MRN is a pointer
+ *  to a string in the table's arena, aligned so that its low bit (which is in
+ *  the first byte, as Windows is little-endian) is clear
+ */
+typedef union tomo_mrn {
+    unsigned long long bits;
+    unsigned char bcd[8];
+    const char *str;
+} TOMO_MRN;
+
+
+/** The MRNs listed under one name. Nearly every patient has one, so the first
+ *  TOMO_MRN_INLINE are stored in place and only further ones spill to an
+ *  array in the arena. The reply rendered from them follows the key's nul, and
+ *  its place is kept here so that serving it measures nothing
+ */
+typedef struct tomo_mrnvals {
+    unsigned count;
+    unsigned cap;       /* Capacity of spill, once count > TOMO_MRN_INLINE */
+    unsigned keylen;    /* Length of the key, so the reply is at key + keylen + 1 */
+    unsigned replylen;  /* Length of the reply */
+    union {
+        TOMO_MRN inl[TOMO_MRN_INLINE];
+        TOMO_MRN *spill;
+    };
+} TOMO_MRNVALS;
+
+
+/* The name index: string keys to MRN lists, instantiated from map.h. Its
+entries are TOMO_MRNPAIR, and its map type TOMO_MRNMAP */
+#define TOMO_MAP_NAME  tomo_mrnmap
+#define TOMO_MAP_TYPE  TOMO_MRNMAP
+#define TOMO_MAP_ENTRY TOMO_MRNPAIR
+#define TOMO_MAP_KEY   char *
+#define TOMO_MAP_VAL   TOMO_MRNVALS
+#include "map.h"
+
+
+/** @brief Get the pre-rendered reply for @p pair
+ *  @param pair
+ *      Table entry
+ *  @param len
+ *      Length of the reply is written here
+ *  @returns The reply, in table memory
+ */
+static inline const char *tomo_mrnpair_reply(const TOMO_MRNPAIR *pair,
+                                             size_t             *len)
+{
+    *len = pair->val.replylen;
+    return pair->key + pair->val.keylen + 1;
+}
+
+
+/** Number of keys tomo_mrntable_lookup_many() keeps in flight at once */
+#define TOMO_MRNTABLE_BATCH TOMO_MAP_BATCH
+
+
+/** Hash table for strings keyed to strings, built on TOMO_MRNMAP (see map.h
+ *  for the probing, Robin Hood placement and backward shift removal). Keys and
+ *  MRN strings that cannot be packed are stored in the table's arena, so
+ *  teardown is one free per chunk rather than one per string. Removed entries'
+ *  strings stay in the arena until the table is freed
+ *
+ *  Loading grows the table all at once, but tomo_mrntable_replace() grows it
+ *  incrementally, since lookups may be waiting on it: the new arrays take the
+ *  adds, and each add or remove after that moves a few clusters of old entries
+ *  over, while lookups check both until the old arrays are drained
+ *
+ *  Once loaded, a table can be frozen (see tomo_mrntable_freeze()) into a
+ *  minimal perfect hash layout: every key then has exactly one slot, and a
+ *  lookup is one hash, one pilot, one slot and one key compare
+ */
+typedef struct tomo_mrntable {
+    TOMO_MRNMAP map;
+
+    /* Frozen tables only: nbuckets pilots, followed by range - map.load
+    entries remapping the slots past the end of map.table, which then holds
+    exactly map.load entries and has neither hashes nor control bytes. NULL
+    while the table is dynamic */
+    unsigned *pilots;
+    unsigned nbuckets, range;
+
+    TOMO_ARENA arena;   /* Keys, MRN strings and spilled MRN arrays */
+} TOMO_MRNTABLE;
+
+
+/** @brief Initialize @p tbl to at least @p minsize capacity. This function is
+ *      safe to call on an initialized table: It will free the table and
+ *      reinitialize it
+ *  @param tbl
+ *      Hash table
+ *  @param minsize
+ *      Minimum initial size. This is rounded up to the first power of two not
+ *      less than its value (and no less than TOMO_MAP_GROUP)
+ *  @returns Nonzero on error
+ */
+int tomo_mrntable_init(TOMO_MRNTABLE *tbl, unsigned minsize);
+
+
+/** @brief Grow @p tbl so that @p count names fit without it resizing again.
+ *      Loading knows roughly how many rows are coming, and reserving for that
+ *      many up front saves rehashing every name at each doubling on the way.
+ *      Reserving on a frozen table does nothing
+ *  @param tbl
+ *      Hash table
+ *  @param count
+ *      Number of names to make room for, including those already present
+ *  @returns Nonzero on error
+ */
+int tomo_mrntable_reserve(TOMO_MRNTABLE *tbl, unsigned count);
+
+
+/** @brief Insert @p key, @p val into @p tbl
+ *  @param tbl
+ *      Hash table
+ *  @param key
+ *      Key string. This is copied into the table's arena
+ *  @param val
+ *      Value string. This is also copied into the arena
+ *  @returns Negative on failure, 0 on success, and positive if @p val is
+ *      already listed under @p key. Values for an existing key are appended to
+ *      its list
+ */
+int tomo_mrntable_insert(TOMO_MRNTABLE *tbl, const char *key, const char *val);
+
+
+/** @brief Remove @p key and its MRNs from @p tbl. This works the same while
+ *      the table grows incrementally, and takes that a step further
+ *  @param tbl
+ *      Hash table
+ *  @param key
+ *      Key string
+ *  @returns Negative on failure, 0 on success, and positive if @p key was not
+ *      in the table
+ */
+int tomo_mrntable_remove(TOMO_MRNTABLE *tbl, const char *key);
+
+
+/** @brief Replace the MRNs listed under @p key in @p tbl with @p vals, adding
+ *      @p key if it is missing. Pass no values to remove it. On failure the
+ *      MRNs listed before are left as they were. A new key that takes the
+ *      table past its load limit starts an incremental resize
+ *  @param tbl
+ *      Hash table
+ *  @param key
+ *      Key string
+ *  @param vals
+ *      Value strings
+ *  @param count
+ *      Number of values
+ *  @returns Nonzero on error
+ */
+int tomo_mrntable_replace(TOMO_MRNTABLE     *tbl,
+                          const char        *key,
+                          const char *const *vals,
+                          unsigned           count);
+
+
+/** @brief Merge every entry of @p src into @p dst, then free @p src. MRNs of a
+ *      name found in both are appended to those already in @p dst, in order.
+ *      Names new to @p dst are moved over without copying their strings, by
+ *      handing @p src's arena to @p dst
+ *  @param dst
+ *      Hash table to merge into
+ *  @param src
+ *      Hash table to merge from. This is freed, even on failure
+ *  @returns Nonzero on error
+ */
+int tomo_mrntable_merge(TOMO_MRNTABLE *dst, TOMO_MRNTABLE *src);
+
+
+/** @brief Freeze @p tbl. Its entries are moved into a table of exactly
+ *      tbl->map.load slots, placed by a minimal perfect hash built over the keys
+ *      (PTHash-style: keys are split into small buckets, and each bucket gets a
+ *      pilot value that sends all of its keys to free slots). Lookups keep
+ *      working, and no longer probe; inserting into a frozen table is an error.
+ *      Freezing an empty or already frozen table does nothing
+ *  @param tbl
+ *      MRN table
+ *  @returns Nonzero on error, in which case @p tbl is unchanged
+ */
+int tomo_mrntable_freeze(TOMO_MRNTABLE *tbl);
+
+
+/** @brief Look up @p key in @p tbl
+ *  @param tbl
+ *      MRN table
+ *  @param key
+ *      Key to look up
+ *  @returns A pointer to the bucket holding @p key and its MRNs, or NULL if
+ *      not found
+ */
+const TOMO_MRNPAIR *tomo_mrntable_lookup(TOMO_MRNTABLE *tbl, const char *key);
+
+
+/** @brief Look up every key in @p keys. Keys are taken TOMO_MRNTABLE_BATCH at a
+ *      time: the whole batch is hashed and the memory each key will touch is
+ *      prefetched before any of them is resolved, so the cache misses overlap
+ *      instead of stalling one after the other
+ *  @param tbl
+ *      MRN table
+ *  @param keys
+ *      Keys to look up
+ *  @param count
+ *      Number of keys
+ *  @param pairs
+ *      Array of @p count results, each as tomo_mrntable_lookup() would return
+ */
+void tomo_mrntable_lookup_many(TOMO_MRNTABLE       *tbl,
+                               const char *const   *keys,
+                               size_t               count,
+                               const TOMO_MRNPAIR **pairs);
+
+
+/** @brief Log a histogram of how far each key sits from its home bucket, and
+ *      the mean number of control groups a successful lookup tests
+ *  @param tbl
+ *      MRN table
+ *  @param lvl
+ *      Log level to write to
+ */
+void tomo_mrntable_log_probes(const TOMO_MRNTABLE *tbl, TOMO_LOGLVL lvl);
+
+
+/** @brief Frees memory held by @p tbl
+ *  @param tbl
+ *      MRN table. The memory for this object is externally managed, but its
+ *      contents will be cleared by this call
+ */
+void tomo_mrntable_free(TOMO_MRNTABLE *tbl);
+
+
+#endif /* TOMOSRV_TABLE_H */
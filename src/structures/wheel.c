@@ -0,0 +1,235 @@
+#include <limits.h>
+#include <string.h>
+
+#include "wheel.h"
+
+#include <intrin.h>
+
+#define TOMO_WHEEL_MASK (TOMO_WHEEL_SLOTS - 1)
+
+
+/** @brief Get the slot index of tick @p t on @p level */
+static unsigned tomo_wheel_index(unsigned long long t, unsigned level)
+{
+    return (unsigned)(t >> (TOMO_WHEEL_BITS * level)) & TOMO_WHEEL_MASK;
+}
+
+
+/** @brief Link @p tmr into the slot its expiry falls into, relative to the
+ *      current tick
+ */
+static void tomo_wheel_link(TOMO_WHEEL *wheel, TOMO_TIMER *tmr)
+{
+    unsigned long long delta, expiry = tmr->expiry;
+    TOMO_TIMER **head;
+    unsigned level;
+
+    if (expiry < wheel->now) {
+        expiry = wheel->now;
+    }
+    delta = expiry - wheel->now;
+    if (delta >= TOMO_WHEEL_SPAN) {
+        /* Park it as far out as possible, it gets relinked on cascade */
+        delta = TOMO_WHEEL_SPAN - 1;
+        expiry = wheel->now + delta;
+    }
+    for (level = 0; delta >> (TOMO_WHEEL_BITS * (level + 1)); level++)
+        ;
+    tmr->level = (unsigned char)level;
+    tmr->slot = (unsigned char)tomo_wheel_index(expiry, level);
+    head = &wheel->slots[level][tmr->slot];
+    tmr->next = *head;
+    if (*head) {
+        (*head)->pprev = &tmr->next;
+    }
+    tmr->pprev = head;
+    *head = tmr;
+    wheel->occupied[level] |= 1ULL << tmr->slot;
+}
+
+
+/** @brief Unlink @p tmr from whatever list it is in. If that list is a wheel
+ *      slot that is now empty, its occupancy bit is cleared
+ */
+static void tomo_wheel_unlink(TOMO_WHEEL *wheel, TOMO_TIMER *tmr)
+{
+    TOMO_TIMER **slot = &wheel->slots[tmr->level][tmr->slot];
+
+    *tmr->pprev = tmr->next;
+    if (tmr->next) {
+        tmr->next->pprev = tmr->pprev;
+    }
+    tmr->next = NULL;
+    tmr->pprev = NULL;
+    if (!*slot) {
+        wheel->occupied[tmr->level] &= ~(1ULL << tmr->slot);
+    }
+}
+
+
+void tomo_wheel_init(TOMO_WHEEL *wheel, unsigned long long now)
+{
+    memset(wheel, 0, sizeof *wheel);
+    wheel->now = now + 1;
+}
+
+
+void tomo_wheel_insert(TOMO_WHEEL *wheel, TOMO_TIMER *tmr, unsigned long long expiry)
+{
+    if (tmr->pprev) {
+        tomo_wheel_unlink(wheel, tmr);
+    } else {
+        wheel->count++;
+    }
+    tmr->expiry = expiry;
+    tomo_wheel_link(wheel, tmr);
+}
+
+
+void tomo_wheel_cancel(TOMO_WHEEL *wheel, TOMO_TIMER *tmr)
+{
+    if (tmr->pprev) {
+        tomo_wheel_unlink(wheel, tmr);
+        wheel->count--;
+    }
+}
+
+
+/** @brief Detach the list in slot @p idx of @p level. Its timers stay linked to
+ *      each other, and can still be cancelled while the caller walks it
+ *  @param head
+ *      Caller's list head, which takes over the list
+ */
+static void tomo_wheel_detach(TOMO_WHEEL   *wheel,
+                              unsigned      level,
+                              unsigned      idx,
+                              TOMO_TIMER  **head)
+{
+    *head = wheel->slots[level][idx];
+    wheel->slots[level][idx] = NULL;
+    wheel->occupied[level] &= ~(1ULL << idx);
+    if (*head) {
+        (*head)->pprev = head;
+    }
+}
+
+
+/** @brief Relink every timer in the current slot of @p level, which has just
+ *      come due, into the levels below
+ */
+static void tomo_wheel_cascade(TOMO_WHEEL *wheel, unsigned level)
+{
+    TOMO_TIMER *head, *tmr;
+
+    tomo_wheel_detach(wheel, level, tomo_wheel_index(wheel->now, level), &head);
+    while (head) {
+        tmr = head;
+        head = tmr->next;
+        if (head) {
+            head->pprev = &head;
+        }
+        tomo_wheel_link(wheel, tmr);
+    }
+}
+
+
+/** @brief Run the timers in bottom-level slot @p idx. The current tick must
+ *      already be past it, so that timers re-armed from a callback land in a
+ *      slot that is still ahead
+ */
+static void tomo_wheel_fire(TOMO_WHEEL *wheel, unsigned idx)
+{
+    TOMO_TIMER *head, *tmr;
+
+    tomo_wheel_detach(wheel, 0, idx, &head);
+    while (head) {
+        tmr = head;
+        /* level/slot no longer describe the list tmr is in, so unlink here */
+        head = tmr->next;
+        if (head) {
+            head->pprev = &head;
+        }
+        tmr->next = NULL;
+        tmr->pprev = NULL;
+        if (tmr->expiry >= wheel->now) {
+            /* Parked beyond the wheel's span, not due yet */
+            tomo_wheel_link(wheel, tmr);
+        } else {
+            wheel->count--;
+            tmr->proc(tmr, tmr->data);
+        }
+    }
+}
+
+
+/** @brief Get the distance from the current tick to the next occupied bottom
+ *      slot in the current block of TOMO_WHEEL_SLOTS ticks
+ *  @returns The distance, or the distance to the end of the block if there is
+ *      no such slot
+ */
+static unsigned tomo_wheel_next_slot(const TOMO_WHEEL *wheel)
+{
+    const unsigned idx = tomo_wheel_index(wheel->now, 0);
+    unsigned long pos;
+
+    if (_BitScanForward64(&pos, wheel->occupied[0] >> idx)) {
+        return pos;
+    }
+    return TOMO_WHEEL_SLOTS - idx;
+}
+
+
+void tomo_wheel_advance(TOMO_WHEEL *wheel, unsigned long long now)
+{
+    unsigned long long next;
+    unsigned idx, level;
+
+    while (wheel->now <= now) {
+        idx = tomo_wheel_index(wheel->now, 0);
+        if (!idx) {
+            /* Block boundary: cascade each level whose slot just came due */
+            for (level = 1; level < TOMO_WHEEL_LEVELS; level++) {
+                tomo_wheel_cascade(wheel, level);
+                if (tomo_wheel_index(wheel->now, level)) {
+                    break;
+                }
+            }
+        }
+        if (wheel->occupied[0] & (1ULL << idx)) {
+            wheel->now++;
+            tomo_wheel_fire(wheel, idx);
+        } else {
+            /* Skip the empty run, but never past now, since a timer armed
+            later for a skipped tick would otherwise wait a whole rotation */
+            next = wheel->now + tomo_wheel_next_slot(wheel);
+            wheel->now = (next > now) ? now + 1 : next;
+        }
+    }
+}
+
+
+int tomo_wheel_timeout(const TOMO_WHEEL *wheel)
+{
+    unsigned long long ticks;
+    unsigned idx, level;
+
+    if (!wheel->count) {
+        return -1;
+    }
+    /* Counts are relative to the last tick advanced to, which is one before
+    now. Stopping on a block boundary leaves its cascade for the next advance,
+    which may be due immediately */
+    if (!tomo_wheel_index(wheel->now, 0)) {
+        for (level = 1; level < TOMO_WHEEL_LEVELS; level++) {
+            idx = tomo_wheel_index(wheel->now, level);
+            if (wheel->occupied[level] & (1ULL << idx)) {
+                return 1;
+            } else if (idx) {
+                break;
+            }
+        }
+    }
+    /* If nothing is left in this block, wake at its end to cascade */
+    ticks = (unsigned long long)tomo_wheel_next_slot(wheel) + 1;
+    return (ticks > INT_MAX) ? INT_MAX : (int)ticks;
+}
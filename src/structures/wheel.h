@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef TOMOSRV_WHEEL_H
+#define TOMOSRV_WHEEL_H
+
+#include "../defines.h"
+
+
+#define TOMO_WHEEL_BITS   6
+#define TOMO_WHEEL_SLOTS  (1U << TOMO_WHEEL_BITS)
+#define TOMO_WHEEL_LEVELS 4
+
+/** Deadlines further out than this many ticks are parked in the top level and
+ *  re-examined each time it cascades
+ */
+#define TOMO_WHEEL_SPAN   (1ULL << (TOMO_WHEEL_BITS * TOMO_WHEEL_LEVELS))
+
+
+struct tomo_timer;
+
+/** @brief Expiry callback. The timer is already disarmed when this runs, and
+ *      may be re-armed from inside it
+ */
+typedef void TOMO_TIMER_PROC(struct tomo_timer *tmr, void *data);
+
+
+/** Intrusive timer. Zero-initialize it and fill in proc and data. A timer is
+ *  armed iff pprev is not NULL
+ */
+typedef struct tomo_timer {
+    struct tomo_timer *next, **pprev;
+
+    unsigned long long expiry;
+    unsigned char level, slot;
+
+    TOMO_TIMER_PROC *proc;
+    void *data;
+} TOMO_TIMER;
+
+
+/** Hierarchical timer wheel. Each level has TOMO_WHEEL_SLOTS slots, and each
+ *  slot spans TOMO_WHEEL_SLOTS times as many ticks as a slot in the level below.
+ *  Arming and disarming are O(1). Timers are moved down a level when time
+ *  reaches their slot ("cascading"), and fire from the bottom level. A bitmap
+ *  of occupied slots per level lets advancing and the next-expiry query skip
+ *  empty stretches without visiting them
+ */
+typedef struct tomo_wheel {
+    unsigned long long now;     /* Every tick before this one has been run */
+    unsigned count;             /* Armed timers */
+
+    unsigned long long occupied[TOMO_WHEEL_LEVELS];
+    TOMO_TIMER *slots[TOMO_WHEEL_LEVELS][TOMO_WHEEL_SLOTS];
+} TOMO_WHEEL;
+
+
+/** @brief Initialize an empty wheel
+ *  @param wheel
+ *      Timer wheel
+ *  @param now
+ *      Current tick, treated as already advanced to
+ */
+void tomo_wheel_init(TOMO_WHEEL *wheel, unsigned long long now);
+
+
+/** @brief Arm @p tmr to fire at tick @p expiry. If it is already armed, it is
+ *      moved
+ *  @param wheel
+ *      Timer wheel
+ *  @param tmr
+ *      Timer
+ *  @param expiry
+ *      Absolute tick. Ticks already in the past fire on the next advance
+ */
+void tomo_wheel_insert(TOMO_WHEEL *wheel, TOMO_TIMER *tmr, unsigned long long expiry);
+
+
+/** @brief Disarm @p tmr. Nops if it is not armed
+ *  @param wheel
+ *      Timer wheel
+ *  @param tmr
+ *      Timer
+ */
+void tomo_wheel_cancel(TOMO_WHEEL *wheel, TOMO_TIMER *tmr);
+
+
+/** @brief Run every timer that expires at or before @p now
+ *  @param wheel
+ *      Timer wheel
+ *  @param now
+ *      Current tick
+ */
+void tomo_wheel_advance(TOMO_WHEEL *wheel, unsigned long long now);
+
+
+/** @brief Get the number of ticks the owner can sleep before it must advance
+ *      the wheel again
+ *  @param wheel
+ *      Timer wheel
+ *  @returns -1 if no timers are armed, otherwise a number of ticks from the
+ *      last advance. This is never later than the next expiry, but may be
+ *      earlier when a higher level needs to cascade
+ */
+int tomo_wheel_timeout(const TOMO_WHEEL *wheel);
+
+
+#endif /* TOMOSRV_WHEEL_H */
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <string.h>
+
+/* The classifiers and the pointer that picks between them are private to the
+scanner, so it is compiled in here to force each of them in turn */
+#include "src/scan.c"
+
+
+/** Largest input the random test generates */
+#define TEST_MAXINPUT (1 << 20)
+
+/** Room for the fields and rows either side writes out */
+#define TEST_MAXOUTPUT (1 << 22)
+
+
+/** Fields and rows as text: "[col:field]" for each projected field, and a
+ *  newline at the end of each row
+ */
+typedef struct test_out {
+    char text[TEST_MAXOUTPUT];
+    size_t len;
+    size_t nrows;
+} TEST_OUT;
+
+
+/** The reference tokenizer: libcsv's state machine outside of strict mode,
+ *  with its trimming, reduced to the projected columns
+ */
+typedef struct test_ref {
+    const unsigned *cols;
+    unsigned ncols, col, next;
+
+    char field[TEST_MAXINPUT];
+    size_t len;
+    size_t spaces;  /* Trailing spaces and tabs of field, if unquoted */
+    bool quoted;
+
+    TEST_OUT *out;
+} TEST_REF;
+
+
+static TEST_OUT test_expect, test_actual;
+
+
+/** @brief Step a xorshift generator, so every run sees the same sequence */
+static unsigned test_rand(unsigned long long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (unsigned)(*state >> 32);
+}
+
+
+/** @brief Write a field to @p out, as the scanner would hand it over */
+static void test_put(TEST_OUT *out, unsigned col, const char *field, size_t len)
+{
+    if (len > TOMO_SCAN_FIELDLEN - 1) {
+        len = TOMO_SCAN_FIELDLEN - 1;
+    }
+    out->len += sprintf(out->text + out->len, "[%u:%.*s]", col, (int)len, field);
+}
+
+
+static void test_fieldcb(unsigned col, const char *field, size_t len, void *data)
+{
+    if (strlen(field) != len) {
+        field = "length does not match";
+        len = strlen(field);
+    }
+    test_put(data, col, field, len);
+}
+
+
+static void test_rowcb(void *data)
+{
+    TEST_OUT *const out = data;
+
+    out->text[out->len++] = '\n';
+    out->nrows++;
+}
+
+
+/** @brief End the reference's current field, as libcsv's SUBMIT_FIELD does */
+static void test_ref_field(TEST_REF *ref)
+{
+    if (!ref->quoted) {
+        ref->len -= ref->spaces;
+    }
+    if (ref->next < ref->ncols && ref->col == ref->cols[ref->next]) {
+        test_put(ref->out, ref->col, ref->field, ref->len);
+        ref->next++;
+    }
+    ref->col++;
+    ref->len = 0;
+    ref->spaces = 0;
+    ref->quoted = false;
+}
+
+
+/** @brief End the reference's current row */
+static void test_ref_row(TEST_REF *ref)
+{
+    test_rowcb(ref->out);
+    ref->col = 0;
+    ref->next = 0;
+}
+
+
+/** @brief Tokenize @p len bytes at @p buf with the reference */
+static void test_ref_parse(TEST_REF *ref, const char *buf, size_t len)
+{
+    enum { ROW_NOT_BEGUN, FIELD_NOT_BEGUN, FIELD_BEGUN, FIELD_MIGHT_HAVE_ENDED } st = ROW_NOT_BEGUN;
+    bool term, space;
+    size_t i;
+    char c;
+
+    for (i = 0; i < len; i++) {
+        c = buf[i];
+        term = (c == '\n' || c == '\r');
+        space = (c == ' ' || c == '\t');
+        switch (st) {
+        case ROW_NOT_BEGUN:
+            if (term) {
+                break;
+            }
+            st = FIELD_NOT_BEGUN;
+            /* Fall through */
+        case FIELD_NOT_BEGUN:
+            if (space) {
+                break;
+            } else if (c == '"') {
+                ref->quoted = true;
+                st = FIELD_BEGUN;
+            } else if (c == ',') {
+                test_ref_field(ref);
+            } else if (term) {
+                test_ref_field(ref);
+                test_ref_row(ref);
+                st = ROW_NOT_BEGUN;
+            } else {
+                ref->field[ref->len++] = c;
+                st = FIELD_BEGUN;
+            }
+            break;
+        case FIELD_BEGUN:
+            if (c == '"' && ref->quoted) {
+                ref->field[ref->len++] = c;
+                st = FIELD_MIGHT_HAVE_ENDED;
+            } else if ((c == ',' || term) && !ref->quoted) {
+                test_ref_field(ref);
+                if (term) {
+                    test_ref_row(ref);
+                }
+                st = (term) ? ROW_NOT_BEGUN : FIELD_NOT_BEGUN;
+            } else {
+                ref->field[ref->len++] = c;
+                ref->spaces = (!ref->quoted && space) ? ref->spaces + 1 : 0;
+            }
+            break;
+        case FIELD_MIGHT_HAVE_ENDED:
+            if (c == ',' || term) {
+                /* Drop the closing quote and what trailed it */
+                ref->len -= ref->spaces + 1;
+                test_ref_field(ref);
+                if (term) {
+                    test_ref_row(ref);
+                }
+                st = (term) ? ROW_NOT_BEGUN : FIELD_NOT_BEGUN;
+            } else if (space) {
+                ref->field[ref->len++] = c;
+                ref->spaces++;
+            } else if (c == '"' && !ref->spaces) {
+                /* A doubled quote, of which one was kept */
+                st = FIELD_BEGUN;
+            } else if (c == '"') {
+                ref->field[ref->len++] = c;
+                ref->spaces = 0;
+            } else {
+                ref->field[ref->len++] = c;
+                ref->spaces = 0;
+                st = FIELD_BEGUN;
+            }
+            break;
+        }
+    }
+    if (st == FIELD_MIGHT_HAVE_ENDED) {
+        ref->len -= ref->spaces + 1;
+    }
+    if (st != ROW_NOT_BEGUN) {
+        test_ref_field(ref);
+        test_ref_row(ref);
+    }
+}
+
+
+/** @brief Generate CSV into @p buf: rows of plain, padded and quoted fields,
+ *      the quoted ones holding commas, CR, LF and doubled quotes and often
+ *      running across blocks, with empty rows and both kinds of line end.
+ *      The last row may lack its newline
+ *  @param state
+ *      Generator state
+ *  @param buf
+ *      Buffer of TEST_MAXINPUT bytes
+ *  @param stray
+ *      Whether to also generate fields with quotes RFC 4180 does not allow
+ *  @returns Length of the input
+ */
+static size_t test_gen(unsigned long long *state, char *buf, bool stray)
+{
+    static const char inquotes[] = "xyz ,\n\r\"";
+    const unsigned nrows = test_rand(state) % 40;
+    unsigned row, col, ncols, i, n;
+    size_t len = 0;
+
+    for (row = 0; row < nrows; row++) {
+        if (test_rand(state) % 10 == 0) {
+            len += sprintf(buf + len, (test_rand(state) % 2) ? "\n" : "\r\n");
+            continue;
+        }
+        ncols = test_rand(state) % 30;
+        for (col = 0; col < ncols; col++) {
+            if (col) {
+                buf[len++] = ',';
+            }
+            switch (test_rand(state) % ((stray) ? 9 : 5)) {
+            case 0:
+                for (i = test_rand(state) % 8; i; i--) {
+                    buf[len++] = "ab c9"[test_rand(state) % 5];
+                }
+                break;
+            case 1:
+                if (test_rand(state) % 2) {
+                    buf[len++] = ' ';
+                }
+                buf[len++] = '"';
+                for (n = test_rand(state) % 300; n; n--) {
+                    buf[len] = inquotes[test_rand(state) % (sizeof inquotes - 1)];
+                    if (buf[len++] == '"') {
+                        buf[len++] = '"';
+                    }
+                }
+                buf[len++] = '"';
+                if (test_rand(state) % 2) {
+                    buf[len++] = '\t';
+                }
+                break;
+            case 2:
+                len += sprintf(buf + len, "%u", test_rand(state));
+                break;
+            case 3:
+                len += sprintf(buf + len, " x y ");
+                break;
+            case 4:
+                break;
+            case 5:
+                len += sprintf(buf + len, "ab\"c");
+                break;
+            case 6:
+                len += sprintf(buf + len, "\"ab\"c d ");
+                break;
+            case 7:
+                len += sprintf(buf + len, "\"a\" \"b\" ");
+                break;
+            default:
+                /* Rarely, a quote left open to the end of the input */
+                len += sprintf(buf + len, (test_rand(state) % 8) ? "\"\"x\"\"" : "\"open, to the end");
+            }
+        }
+        if (row + 1 < nrows || test_rand(state) % 2) {
+            len += sprintf(buf + len, (test_rand(state) % 2) ? "\n" : "\r\n");
+        }
+    }
+    return len;
+}
+
+
+/** @brief Scan @p len bytes at @p buf with the scanner, and check that it
+ *      gives what the reference expects
+ *  @param split
+ *      Whether to feed the input in random pieces. Blocks are counted from
+ *      the start of each piece, so only whole input keeps the edges in place
+ *  @returns Nonzero on a mismatch, which is printed
+ */
+static int test_scan(unsigned long long *state,
+                     const char         *buf,
+                     size_t              len,
+                     const unsigned     *cols,
+                     unsigned            ncols,
+                     bool                split,
+                     bool               *lenient)
+{
+    static TOMO_SCANNER scan;
+    size_t done = 0, end = 0;
+
+    memset(&scan, 0, sizeof scan);
+    memcpy(scan.cols, cols, ncols * sizeof *cols);
+    scan.ncols = ncols;
+    scan.fieldcb = test_fieldcb;
+    scan.rowcb = test_rowcb;
+    scan.data = &test_actual;
+    test_actual.len = 0;
+    test_actual.nrows = 0;
+    /* Whatever a piece leaves unconsumed goes at the front of the next, which
+    always reaches further, as reading more of a stream would */
+    do {
+        end += (split && len > end) ? 1 + test_rand(state) % (len - end) : len - end;
+        done += tomo_scan(&scan, buf + done, end - done, end == len);
+    } while (end < len);
+    if (done != len || scan.nbytes != len || scan.nrows != test_expect.nrows
+     || test_actual.len != test_expect.len
+     || memcmp(test_actual.text, test_expect.text, test_expect.len)) {
+        printf("%ls classifier, %s: %zu of %zu bytes and %zu of %zu rows, giving\n%.*s\n"
+               "where the reference gives\n%.*s\n",
+               tomo_scan_name(), (split) ? "split" : "whole", done, len, scan.nrows, test_expect.nrows,
+               (int)test_actual.len, test_actual.text, (int)test_expect.len, test_expect.text);
+        return 1;
+    }
+    *lenient = scan.lenient;
+    return 0;
+}
+
+
+/** @brief Run @p len bytes at @p buf through the reference, then through the
+ *      scanner with each classifier in @p procs, whole and split
+ *  @param nlenient
+ *      Incremented for each run that turned lenient
+ *  @returns Nonzero on a mismatch
+ */
+static int test_compare(unsigned long long  *state,
+                        const char          *buf,
+                        size_t               len,
+                        const unsigned      *cols,
+                        unsigned             ncols,
+                        TOMO_SCANPROC *const procs[],
+                        unsigned             nprocs,
+                        unsigned            *nlenient)
+{
+    static const wchar_t *names[] = { L"scalar", L"SSE2", L"AVX2" };
+    static TEST_REF ref;
+    bool lenient = false, whole = false;
+    unsigned i;
+
+    ref.cols = cols;
+    ref.ncols = ncols;
+    ref.col = 0;
+    ref.next = 0;
+    ref.len = 0;
+    ref.spaces = 0;
+    ref.quoted = false;
+    ref.out = &test_expect;
+    test_expect.len = 0;
+    test_expect.nrows = 0;
+    test_ref_parse(&ref, buf, len);
+    for (i = 0; i < nprocs; i++) {
+        tomo_scan_proc = procs[i];
+        tomo_scan_desc = names[i];
+        if (test_scan(state, buf, len, cols, ncols, false, &whole)
+         || test_scan(state, buf, len, cols, ncols, true, &lenient)) {
+            return 1;
+        }
+        *nlenient += whole + lenient;
+    }
+    return 0;
+}
+
+
+/** @brief Put doubled quotes, stray quotes, quoted line ends and CRLF at
+ *      every offset around the first two block edges, so that the checks on
+ *      quotes and the prefix XOR carry meet them on both sides of an edge
+ *  @returns Nonzero on a mismatch, or if the scanner turned lenient on input
+ *      it should not have, or did not on input it should have
+ */
+static int test_edges(TOMO_SCANPROC *const procs[], unsigned nprocs)
+{
+    static const struct {
+        const char *text;
+        bool lenient;
+    } tails[] = {
+        { "\"q\"\"r,s\"\n", false },
+        { "\"q,\r\n\",s\r\n", false },
+        { "q\r\ns\r\n", false },
+        { "q\"r,s\n", true },
+        { "q\"r,s\"\n", true },
+        { "\"q\"r,s\n", true },
+        /* The last row without its newline, and a quote left open */
+        { "\"q\"\"r\"", false },
+        { "\"q,r", true }
+    };
+    static const unsigned cols[] = { 0, 1, 2 };
+    static char buf[4 * TOMO_SCAN_BLOCK];
+    unsigned long long state = 0x2545F4914F6CDD1DULL;
+    unsigned pad, t, nlenient;
+    size_t len;
+
+    for (t = 0; t < sizeof tails / sizeof *tails; t++) {
+        for (pad = 0; pad < 2 * TOMO_SCAN_BLOCK + 8; pad++) {
+            /* One row of pad bytes, then the tail across the edge */
+            memset(buf, 'p', pad);
+            buf[pad] = '\n';
+            len = pad + 1 + sprintf(buf + pad + 1, "%s", tails[t].text);
+            nlenient = 0;
+            if (test_compare(&state, buf, len, cols, 3, procs, nprocs, &nlenient)) {
+                printf("Input %u with %u bytes in front\n", t, pad);
+                return 1;
+            }
+            if (nlenient != ((tails[t].lenient) ? 2 * nprocs : 0)) {
+                printf("Input %u with %u bytes in front went lenient in %u of %u runs\n",
+                       t, pad, nlenient, 2 * nprocs);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/** @brief Compare the scanner with the reference over random input, half of
+ *      it with stray quotes
+ *  @returns Nonzero on a mismatch
+ */
+static int test_random(TOMO_SCANPROC *const procs[], unsigned nprocs)
+{
+    static const unsigned cols[] = { 1, 5, 23 };
+    static char buf[TEST_MAXINPUT];
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    unsigned it, nlenient = 0, before, ncols;
+    size_t len;
+
+    for (it = 0; it < 4000; it++) {
+        len = test_gen(&state, buf, it % 2);
+        ncols = 1 + it % 3;
+        before = nlenient;
+        if (test_compare(&state, buf, len, cols, ncols, procs, nprocs, &nlenient)) {
+            printf("Input %u:\n%.*s\n", it, (int)len, buf);
+            return 1;
+        }
+        if (it % 2 == 0 && nlenient != before) {
+            printf("Input %u has no stray quotes, but went lenient\n", it);
+            return 1;
+        }
+    }
+    if (!nlenient) {
+        printf("No stray quote was noticed\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(void)
+{
+    TOMO_SCANPROC *procs[3] = { tomo_scan_classify };
+    unsigned nprocs = 1, failed = 0;
+    int res;
+
+    /* Only what this processor can run, up to what tomo_scan_init() picks */
+    tomo_scan_init();
+#if TOMO_SCAN_SIMD
+    procs[nprocs++] = tomo_scan_classify_sse2;
+    if (tomo_scan_proc == tomo_scan_classify_avx2) {
+        procs[nprocs++] = tomo_scan_classify_avx2;
+    }
+#endif
+    printf("Testing %u classifiers\n", nprocs);
+    res = test_edges(procs, nprocs);
+    failed += (res != 0);
+    printf("block edges: %s\n", (res) ? "FAILED" : "passed");
+    res = test_random(procs, nprocs);
+    failed += (res != 0);
+    printf("random input: %s\n", (res) ? "FAILED" : "passed");
+    return failed != 0;
+}
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <string.h>
+#include "src/structures/table.h"
+#include "src/structures/hash.h"
+#include "src/error.h"
+#include "src/log.h"
+
+
+/** Names the random test draws from */
+#define TEST_NAMES 20000
+
+/** Most MRNs the random test lists under one name */
+#define TEST_MAXMRNS 6
+
+
+/** What the random test expects under one name: count MRNs, each made from
+ *  the name's number and one of seeds
+ */
+typedef struct test_ref {
+    unsigned count;
+    unsigned seeds[TEST_MAXMRNS];
+} TEST_REF;
+
+
+/** @brief Step a xorshift generator, so every run sees the same sequence */
+static unsigned test_rand(unsigned long long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (unsigned)(*state >> 32);
+}
+
+
+/** @brief Write the name numbered @p id to @p buf */
+static const char *test_name(char buf[32], unsigned id)
+{
+    snprintf(buf, 32, "DOE%u^JANE", id);
+    return buf;
+}
+
+
+/** @brief Write the MRN made from @p id and @p seed to @p buf. Every other one
+ *      is all digits, so packed and string MRNs are mixed
+ */
+static const char *test_mrn(char buf[32], unsigned id, unsigned seed)
+{
+    snprintf(buf, 32, (seed & 1) ? "%u%u" : "M%u-%u", id, seed);
+    return buf;
+}
+
+
+/** @brief Check that @p key is in @p tbl with the MRNs in @p ref, or missing
+ *      if @p ref lists none
+ *  @returns Nonzero on a mismatch, which is printed
+ */
+static int test_check(TOMO_MRNTABLE *tbl, const char *key, unsigned id, const TEST_REF *ref)
+{
+    const TOMO_MRNPAIR *pair = tomo_mrntable_lookup(tbl, key);
+    char expect[TEST_MAXMRNS * 32 + 2], mrn[32];
+    const char *reply;
+    size_t len = 0, replylen;
+    unsigned i;
+
+    if (!ref->count || !pair) {
+        if (!ref->count != !pair) {
+            printf("%s: expected %s\n", key, (pair) ? "no entry" : "an entry");
+            return 1;
+        }
+        return 0;
+    }
+    for (i = 0; i < ref->count; i++) {
+        len += sprintf(expect + len, "%s\n", test_mrn(mrn, id, ref->seeds[i]));
+    }
+    expect[len++] = '\n';
+    reply = tomo_mrnpair_reply(pair, &replylen);
+    if (strcmp(pair->key, key) || replylen != len || memcmp(reply, expect, len)) {
+        printf("%s: reply %.*s does not match %.*s\n", key, (int)replylen, reply, (int)len, expect);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Check every name in @p refs, one at a time and in batches
+ *  @returns Nonzero on a mismatch
+ */
+static int test_check_all(TOMO_MRNTABLE *tbl, const TEST_REF *refs)
+{
+    static char names[TOMO_MRNTABLE_BATCH][32];
+    const char *keys[TOMO_MRNTABLE_BATCH];
+    const TOMO_MRNPAIR *pairs[TOMO_MRNTABLE_BATCH];
+    unsigned id, i, n, load = 0;
+
+    for (id = 0; id < TEST_NAMES; id += n) {
+        n = (TEST_NAMES - id < TOMO_MRNTABLE_BATCH) ? TEST_NAMES - id : TOMO_MRNTABLE_BATCH;
+        for (i = 0; i < n; i++) {
+            keys[i] = test_name(names[i], id + i);
+            if (test_check(tbl, keys[i], id + i, &refs[id + i])) {
+                return 1;
+            }
+            load += (refs[id + i].count != 0);
+        }
+        tomo_mrntable_lookup_many(tbl, keys, n, pairs);
+        for (i = 0; i < n; i++) {
+            if (pairs[i] != tomo_mrntable_lookup(tbl, keys[i])) {
+                printf("%s: batched lookup differs\n", keys[i]);
+                return 1;
+            }
+        }
+    }
+    if (load != tbl->map.load) {
+        printf("Table holds %u names, expected %u\n", tbl->map.load, load);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Get how far the key in bucket @p idx of @p map sits from its home */
+static unsigned test_dist(const TOMO_MRNMAP *map, unsigned idx)
+{
+    return (idx - tomo_map_home(map->hashes[idx])) & (map->len - 1);
+}
+
+
+/** @brief Check that no bucket of @p map is empty between a key and its home,
+ *      which removal by backward shift has to keep true
+ *  @returns Nonzero if one is
+ */
+static int test_no_gaps(const TOMO_MRNMAP *map)
+{
+    unsigned i, prev;
+
+    for (i = 0; i < map->len; i++) {
+        prev = (i - 1) & (map->len - 1);
+        if (map->ctrl[i] != TOMO_CTRL_EMPTY
+         && test_dist(map, i)
+         && map->ctrl[prev] == TOMO_CTRL_EMPTY) {
+            printf("Bucket %u of %u is cut off from its home\n", i, map->len);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/** @brief Check both the arrays of @p tbl and those an incremental resize is
+ *      draining, which have to stay a map of their own
+ *  @returns Nonzero on a gap in either
+ */
+static int test_no_gaps_all(const TOMO_MRNTABLE *tbl)
+{
+    const TOMO_MRNMAP old = {
+        .len = tbl->map.old.len,
+        .hashes = tbl->map.old.hashes,
+        .ctrl = tbl->map.old.ctrl
+    };
+
+    return test_no_gaps(&tbl->map) || (old.ctrl && test_no_gaps(&old));
+}
+
+
+/** @brief Insert, replace and remove names at random against a reference,
+ *      from a table that starts at its smallest, so that it resizes many times
+ *      both at once (inserts) and incrementally (replaces)
+ *  @returns Nonzero on failure
+ */
+static int test_random(void)
+{
+    static TEST_REF refs[TEST_NAMES];
+    const char *vals[TEST_MAXMRNS];
+    char name[32], mrns[TEST_MAXMRNS][32];
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    unsigned op, id, i, count, seed = 0, incremental = 0;
+    TOMO_MRNTABLE tbl = { 0 };
+    TEST_REF *ref;
+    int res = 0;
+
+    if (tomo_mrntable_init(&tbl, 0)) {
+        return 1;
+    }
+    for (op = 0; !res && op < 400000; op++) {
+        /* Draw from a range that widens, so the table keeps growing */
+        id = test_rand(&state) % (TEST_NAMES / 8 + op / 16 % (TEST_NAMES - TEST_NAMES / 8));
+        ref = &refs[id];
+        test_name(name, id);
+        switch (test_rand(&state) % 8) {
+        case 0:
+        case 1:
+            if (ref->count < TEST_MAXMRNS) {
+                ref->seeds[ref->count] = ++seed;
+                res = tomo_mrntable_insert(&tbl, name, test_mrn(mrns[0], id, seed)) != 0;
+                ref->count++;
+            }
+            break;
+        case 2:
+            res = tomo_mrntable_remove(&tbl, name) != !ref->count;
+            ref->count = 0;
+            break;
+        default:
+            /* A replace with no MRNs removes */
+            count = test_rand(&state) % (TEST_MAXMRNS + 1);
+            for (i = 0; i < count; i++) {
+                ref->seeds[i] = ++seed;
+                vals[i] = test_mrn(mrns[i], id, seed);
+            }
+            res = tomo_mrntable_replace(&tbl, name, vals, count);
+            ref->count = count;
+        }
+        if (res) {
+            printf("Operation %u on %s failed\n", op, name);
+        } else if (tbl.map.old.table) {
+            incremental++;
+            res = test_check(&tbl, name, id, ref)
+               || (incremental % 64 == 0 && test_no_gaps_all(&tbl));
+        }
+        if (!res && op % 50000 == 0) {
+            res = test_check_all(&tbl, refs);
+        }
+    }
+    if (!res) {
+        res = test_check_all(&tbl, refs);
+    }
+    if (!res && (tbl.map.resizes < 8 || !incremental)) {
+        printf("Only %u resizes, %u operations during incremental ones\n", tbl.map.resizes, incremental);
+        res = 1;
+    }
+    tomo_mrntable_free(&tbl);
+    return res;
+}
+
+
+/** @brief Fill the last buckets of a small table and the first, so that probe
+ *      sequences wrap around its end, then remove the keys one by one in
+ *      several orders and check the rest after each removal
+ *  @returns Nonzero on failure
+ */
+static int test_wrap(void)
+{
+    /* Homes to fill, relative to the end of the table */
+    static const unsigned homes[] = { 2, 1, 1, 1, 1, 0, 0 };
+    enum { NKEYS = sizeof homes / sizeof *homes };
+    static const TEST_REF one = { 1, { 1 } };
+    char names[NKEYS][32], mrn[32];
+    unsigned order[NKEYS], i, j, k, round, id = 0, wrapped = 0;
+    TOMO_MRNTABLE tbl = { 0 };
+    TEST_REF refs[NKEYS];
+    int res = 0;
+
+    if (tomo_mrntable_init(&tbl, TOMO_MAP_GROUP)) {
+        return 1;
+    }
+    for (i = 0; i < NKEYS; i++) {
+        do {
+            test_name(names[i], ++id);
+        } while ((tomo_map_home(tomo_hash(names[i], strlen(names[i]))) + homes[i] + 1) % tbl.map.len);
+    }
+    for (round = 0; !res && round < NKEYS; round++) {
+        for (i = 0; !res && i < NKEYS; i++) {
+            res = tomo_mrntable_insert(&tbl, names[i], test_mrn(mrn, 0, 1)) != 0;
+            refs[i] = one;
+            /* NKEYS is prime, so any multiplier short of it permutes */
+            order[i] = (i * (round % (NKEYS - 1) + 1) + round) % NKEYS;
+        }
+        for (i = 0; i < tbl.map.len / 2; i++) {
+            wrapped += tbl.map.ctrl[i] != TOMO_CTRL_EMPTY && test_dist(&tbl.map, i);
+        }
+        for (i = 0; !res && i < NKEYS; i++) {
+            k = order[i];
+            res = tomo_mrntable_remove(&tbl, names[k]) != 0;
+            refs[k].count = 0;
+            for (j = 0; !res && j < NKEYS; j++) {
+                res = test_check(&tbl, names[j], 0, &refs[j]);
+            }
+            res = res || test_no_gaps(&tbl.map);
+        }
+        if (res) {
+            printf("Round %u failed\n", round);
+        }
+    }
+    if (!res && (!wrapped || tbl.map.resizes)) {
+        printf("Keys never wrapped around the end of one table\n");
+        res = 1;
+    }
+    tomo_mrntable_free(&tbl);
+    return res;
+}
+
+
+/** @brief Merge tables that share names, and check that each shared name
+ *      lists its MRNs from the table merged into first, in order
+ *  @returns Nonzero on failure
+ */
+static int test_merge(void)
+{
+    static TEST_REF refs[TEST_NAMES];
+    TOMO_MRNTABLE dst = { 0 }, src = { 0 };
+    char name[32], mrn[32];
+    unsigned id, part, seed;
+    int res;
+
+    res = tomo_mrntable_init(&dst, 0);
+    /* Three parts, each naming two names in three and listing one or two
+    MRNs under each, one of them repeated from the part before */
+    for (part = 0; !res && part < 3; part++) {
+        res = tomo_mrntable_init(&src, 0);
+        for (id = 0; !res && id < TEST_NAMES; id++) {
+            if (id % 3 == part) {
+                continue;
+            }
+            for (seed = part; !res && seed < part + 1 + id % 2; seed++) {
+                res = tomo_mrntable_insert(&src, test_name(name, id), test_mrn(mrn, id, seed)) < 0;
+                if (!refs[id].count || refs[id].seeds[refs[id].count - 1] != seed) {
+                    refs[id].seeds[refs[id].count++] = seed;
+                }
+            }
+        }
+        res = res || tomo_mrntable_merge(&dst, &src);
+    }
+    res = res || test_check_all(&dst, refs);
+    tomo_mrntable_free(&src);
+    tomo_mrntable_free(&dst);
+    return res;
+}
+
+
+/** @brief Freeze a loaded table, then look up every name in it and as many
+ *      that are not, and check that it takes no more changes
+ *  @returns Nonzero on failure
+ */
+static int test_freeze(void)
+{
+    static TEST_REF refs[TEST_NAMES];
+    const char *val;
+    char name[32], mrn[32];
+    TOMO_MRNTABLE tbl = { 0 };
+    unsigned id, seed;
+    int res;
+
+    res = tomo_mrntable_init(&tbl, 0);
+    /* Every other name is left out, to be looked up as a miss */
+    for (id = 0; !res && id < TEST_NAMES; id += 2) {
+        for (seed = 0; !res && seed <= id % 4; seed++) {
+            res = tomo_mrntable_insert(&tbl, test_name(name, id), test_mrn(mrn, id, seed)) != 0;
+            refs[id].seeds[refs[id].count++] = seed;
+        }
+    }
+    res = res || tomo_mrntable_freeze(&tbl);
+    if (!res && !tbl.pilots) {
+        printf("Table did not freeze\n");
+        res = 1;
+    }
+    res = res || test_check_all(&tbl, refs);
+    if (!res) {
+        val = test_mrn(mrn, 1, 0);
+        if (tomo_mrntable_insert(&tbl, test_name(name, 1), val) >= 0
+         || tomo_mrntable_remove(&tbl, test_name(name, 0)) >= 0
+         || !tomo_mrntable_replace(&tbl, name, &val, 1)) {
+            printf("Frozen table took a change\n");
+            res = 1;
+        }
+        tomo_error_reset();
+    }
+    res = res || test_check_all(&tbl, refs);
+    tomo_mrntable_free(&tbl);
+    return res;
+}
+
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        int (*run)(void);
+    } tests[] = {
+        { "random operations", test_random },
+        { "wraparound removal", test_wrap },
+        { "merge", test_merge },
+        { "freeze", test_freeze }
+    };
+    unsigned i, failed = 0;
+    int res;
+
+    if (tomo_hash_init()) {
+        tomo_log_error(TOMO_LOG_ERROR);
+        return 1;
+    }
+    for (i = 0; i < sizeof tests / sizeof *tests; i++) {
+        res = tests[i].run();
+        if (res) {
+            tomo_log_error(TOMO_LOG_ERROR);
+            failed++;
+        }
+        printf("%s: %s\n", tests[i].name, (res) ? "FAILED" : "passed");
+    }
+    return failed != 0;
+}